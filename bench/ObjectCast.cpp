@@ -0,0 +1,169 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+/*
+ * Compares dynamic_cast with the type bits of Object for a wildcard Fade
+ * over a few hundred textures, as done by a scene transition:
+ *
+ *     Fade("cg*", 500, 0, null, false);
+ *
+ * The classes are stand-ins with the same virtual inheritance as the
+ * engine ones (Movie is both a Playable and a Texture, Object is a
+ * virtual base) so the benchmark builds without the engine's dependencies.
+ * */
+#include <cstdint>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <map>
+using namespace std;
+
+enum
+{
+    OBJECT_GLTEXTURE = 1 << 0,
+    OBJECT_TEXTURE = 1 << 1,
+    OBJECT_PLAYABLE = 1 << 3,
+    OBJECT_MOVIE = 1 << 4
+};
+
+class GLTexture;
+class Playable;
+struct Object
+{
+    Object() : Types(0), pGLTexture(nullptr), pPlayable(nullptr) { }
+    virtual ~Object() { }
+
+    template <class T> T* As()
+    {
+        return (Types & T::TYPE) ? T::Cast(this) : nullptr;
+    }
+
+    uint16_t Types;
+    GLTexture* pGLTexture;
+    Playable* pPlayable;
+};
+
+class GLTexture : virtual public Object
+{
+public:
+    GLTexture() { Types |= OBJECT_GLTEXTURE; pGLTexture = this; }
+};
+
+class Texture : public GLTexture
+{
+public:
+    Texture() : Opacity(1000), Time(0) { Types |= TYPE; }
+
+    static const uint16_t TYPE = OBJECT_TEXTURE;
+    static Texture* Cast(Object* pObject) { return static_cast<Texture*>(pObject->pGLTexture); }
+
+    void Fade(int32_t Time, int32_t Opacity)
+    {
+        this->Time = Time;
+        this->Opacity = Opacity;
+    }
+
+    int32_t Opacity;
+    int32_t Time;
+};
+
+class Playable : virtual public Object
+{
+public:
+    Playable() { Types |= OBJECT_PLAYABLE; pPlayable = this; }
+};
+
+class Movie : public Playable, public Texture
+{
+public:
+    Movie() { Types |= OBJECT_MOVIE; }
+};
+
+typedef map<string, Object*> Holder;
+
+template <class F> static void Wildcard(Holder& Objects, const string& Prefix, F Func)
+{
+    for (auto i = Objects.lower_bound(Prefix); i != Objects.end() && i->first.compare(0, Prefix.size(), Prefix) == 0; ++i)
+        Func(i->second);
+}
+
+template <bool Tagged> static double Measure(Holder& Objects, int N, int64_t& Checksum)
+{
+    auto Begin = chrono::steady_clock::now();
+    for (int n = 0; n < N; ++n)
+    {
+        Wildcard(Objects, "cg", [n] (Object* pObject)
+        {
+            Texture* pTexture = Tagged ? pObject->As<Texture>() : dynamic_cast<Texture*>(pObject);
+            if (pTexture)
+                pTexture->Fade(n, n & 1023);
+        });
+    }
+    double Time = chrono::duration<double, milli>(chrono::steady_clock::now() - Begin).count();
+
+    Checksum = 0;
+    for (auto& i : Objects)
+        if (Texture* pTexture = dynamic_cast<Texture*>(i.second))
+            Checksum += pTexture->Opacity + pTexture->Time;
+    return Time;
+}
+
+int main(int argc, char** argv)
+{
+    int N = argc > 1 ? atoi(argv[1]) : 20000;
+
+    // Mostly textures, with movies and sounds matching the wildcard too
+    Holder Objects;
+    char Name[16];
+    for (int i = 0; i < 400; ++i)
+    {
+        snprintf(Name, sizeof(Name), "cg%03d", i);
+        Object* pObject;
+        if (i % 10 == 0)
+            pObject = new Movie;
+        else if (i % 10 == 1)
+            pObject = new Playable;
+        else
+            pObject = new Texture;
+        Objects[Name] = pObject;
+    }
+    for (int i = 0; i < 200; ++i)
+    {
+        snprintf(Name, sizeof(Name), "bg%03d", i);
+        Objects[Name] = new Texture;
+    }
+
+    // Alternate the two and keep the best run of each to filter out noise
+    int64_t Old, New;
+    double OldTime = 1e9, NewTime = 1e9;
+    for (int i = 0; i < 5; ++i)
+    {
+        OldTime = min(OldTime, Measure<false>(Objects, N, Old));
+        NewTime = min(NewTime, Measure<true>(Objects, N, New));
+    }
+
+    cout << "dynamic_cast: " << OldTime << " ms (checksum " << Old << ")" << endl;
+    cout << "type bits:    " << NewTime << " ms (checksum " << New << ")" << endl;
+
+    for (auto& i : Objects)
+        delete i.second;
+    return Old == New ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+/*
+ * Compares std::function based operator dispatch with the templated
+ * kernels used by NSBInterpreter. The loop below is what the NSS compiler
+ * emits for:
+ *
+ *     while ($i < N) { $s = $s + $i * 3 % 7; $i = $i + 1; }
+ *
+ * The stack and variables are simplified stand-ins for the interpreter
+ * ones so the benchmark builds without the engine's dependencies.
+ * */
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+using namespace std;
+
+enum
+{
+    OP_VAR,
+    OP_LIT,
+    OP_ADD,
+    OP_MUL,
+    OP_MOD,
+    OP_LESS,
+    OP_ASSIGN,
+    OP_IF,
+    OP_JUMP
+};
+
+struct Op
+{
+    int Code;
+    int32_t Arg;
+};
+
+struct Value
+{
+    bool IsFloat;
+    union
+    {
+        int32_t Int;
+        float Float;
+    };
+};
+
+class Machine
+{
+public:
+    Machine() : Top(0) { }
+
+    void Push(int32_t Int) { Stack[Top].IsFloat = false; Stack[Top++].Int = Int; }
+    void Push(float Float) { Stack[Top].IsFloat = true; Stack[Top++].Float = Float; }
+    int32_t PopInt() { Value& Val = Stack[--Top]; return Val.IsFloat ? Val.Float : Val.Int; }
+    float PopFloat() { Value& Val = Stack[--Top]; return Val.IsFloat ? Val.Float : Val.Int; }
+    bool AnyFloat() { return Stack[Top - 1].IsFloat || Stack[Top - 2].IsFloat; }
+
+    // Old style: type erased kernels
+    void IntBinaryOp(function<int32_t(int32_t, int32_t)> Func)
+    {
+        int32_t rhs = PopInt();
+        int32_t lhs = PopInt();
+        Push(Func(lhs, rhs));
+    }
+
+    void FloatBinaryOp(function<float(float, float)> Func)
+    {
+        float rhs = PopFloat();
+        float lhs = PopFloat();
+        Push(Func(lhs, rhs));
+    }
+
+    // New style: kernels specialized at compile time
+    template <class T> void IntBinaryOpT(T Func)
+    {
+        int32_t rhs = PopInt();
+        int32_t lhs = PopInt();
+        Push(Func(lhs, rhs));
+    }
+
+    template <class T> void FloatBinaryOpT(T Func)
+    {
+        float rhs = PopFloat();
+        float lhs = PopFloat();
+        Push(Func(lhs, rhs));
+    }
+
+    template <template <class> class T> void NumericBinaryOp()
+    {
+        if (AnyFloat())
+            FloatBinaryOpT(T<float>());
+        else
+            IntBinaryOpT(T<int32_t>());
+    }
+
+    template <bool Templated> int32_t Run(const vector<Op>& Code)
+    {
+        int32_t Vars[2] = {0, 0};
+        size_t Pc = 0;
+        Top = 0;
+        while (Pc < Code.size())
+        {
+            const Op& Cur = Code[Pc++];
+            switch (Cur.Code)
+            {
+                case OP_VAR: Push(Vars[Cur.Arg]); break;
+                case OP_LIT: Push(Cur.Arg); break;
+                case OP_ASSIGN: Vars[Cur.Arg] = PopInt(); break;
+                case OP_IF: if (!PopInt()) Pc = Cur.Arg; break;
+                case OP_JUMP: Pc = Cur.Arg; break;
+                default:
+                    if (Templated)
+                        Dispatch(Cur.Code);
+                    else
+                        DispatchErased(Cur.Code);
+            }
+        }
+        return Vars[1];
+    }
+
+private:
+    void Dispatch(int Code)
+    {
+        switch (Code)
+        {
+            case OP_ADD: NumericBinaryOp<plus>(); break;
+            case OP_MUL: NumericBinaryOp<multiplies>(); break;
+            case OP_MOD: IntBinaryOpT(modulus<int32_t>()); break;
+            case OP_LESS: NumericBinaryOp<less>(); break;
+        }
+    }
+
+    void DispatchErased(int Code)
+    {
+        switch (Code)
+        {
+#define ERASED(Kernel) \
+    if (AnyFloat()) FloatBinaryOp(Kernel<float>()); else IntBinaryOp(Kernel<int32_t>()); break
+            case OP_ADD: ERASED(plus);
+            case OP_MUL: ERASED(multiplies);
+            case OP_MOD: IntBinaryOp(modulus<int32_t>()); break;
+            case OP_LESS: ERASED(less);
+#undef ERASED
+        }
+    }
+
+    Value Stack[16];
+    size_t Top;
+};
+
+template <bool Templated> static double Measure(Machine& M, const vector<Op>& Code, int32_t& Result)
+{
+    auto Begin = chrono::steady_clock::now();
+    Result = M.Run<Templated>(Code);
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - Begin).count();
+}
+
+int main(int argc, char** argv)
+{
+    int32_t N = argc > 1 ? atoi(argv[1]) : 10000000;
+    enum { I = 0, S = 1 };
+    vector<Op> Code =
+    {
+        /* 0 */ {OP_VAR, I}, {OP_LIT, N}, {OP_LESS, 0}, {OP_IF, 17},
+        /* 4 */ {OP_VAR, S}, {OP_VAR, I}, {OP_LIT, 3}, {OP_MUL, 0},
+        /* 8 */ {OP_LIT, 7}, {OP_MOD, 0}, {OP_ADD, 0}, {OP_ASSIGN, S},
+        /* 12 */ {OP_VAR, I}, {OP_LIT, 1}, {OP_ADD, 0}, {OP_ASSIGN, I},
+        /* 16 */ {OP_JUMP, 0}
+    };
+
+    // Alternate the two and keep the best run of each to filter out noise
+    Machine M;
+    int32_t Old, New;
+    double OldTime = 1e9, NewTime = 1e9;
+    for (int i = 0; i < 5; ++i)
+    {
+        OldTime = min(OldTime, Measure<false>(M, Code, Old));
+        NewTime = min(NewTime, Measure<true>(M, Code, New));
+    }
+
+    cout << "std::function: " << OldTime << " ms (result " << Old << ")" << endl;
+    cout << "templated:     " << NewTime << " ms (result " << New << ")" << endl;
+    return Old == New ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef ARCHIVE_INDEX_HPP
+#define ARCHIVE_INDEX_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+/*
+ * Which archive holds each file, saved next to the archives so they need
+ * not be opened (and their directories parsed) to find a file. The index
+ * is only used if every archive still has the size and modification time
+ * it had when the index was written. Entries are sorted by path and
+ * searched in the mapped file, nothing is read into memory at startup.
+ * */
+class ArchiveIndex
+{
+public:
+    struct Stamp
+    {
+        string Filename;
+        uint64_t Size;
+        int64_t MTime;
+    };
+
+    struct Entry
+    {
+        // Position of the archive in the list the index was written for
+        uint32_t Archive;
+        uint32_t Size;
+    };
+
+    ArchiveIndex(const string& Filename, const vector<Stamp>& Archives);
+    ~ArchiveIndex();
+
+    bool IsValid() { return pRecords != nullptr; }
+    bool Find(const string& Path, Entry& Result);
+
+    static bool GetStamp(const string& Filename, Stamp& Result);
+    static bool Write(const string& Filename, const vector<Stamp>& Archives, const map<string, Entry>& Entries);
+
+private:
+    bool Map(const string& Filename, const vector<Stamp>& Archives);
+
+    const char* pData;
+    size_t Size;
+    const char* pRecords;
+    uint32_t NumRecords;
+};
+
+#endif
@@ -35,6 +35,9 @@ class Choice : public Name
 public:
     Choice();
 
+    static const uint16_t TYPE = OBJECT_CHOICE;
+    static Choice* Cast(Object* pObject) { return static_cast<Choice*>(pObject); }
+
     bool IsSelected(const SDL_Event& Event);
     void SetNextFocus(Choice* pNext, const string& Key);
     void Reset() { ButtonUp = false; }
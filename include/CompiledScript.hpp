@@ -0,0 +1,229 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef COMPILED_SCRIPT_HPP
+#define COMPILED_SCRIPT_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "nsbmagic.hpp"
+#include "Expression.hpp"
+using namespace std;
+
+/*
+ * Interned strings are shared by all engines in the process, so an id
+ * means the same string everywhere. Interning takes a lock, Get does not:
+ * strings are stored in blocks which never move, and a thread can only
+ * know an id after the Intern which created it has returned.
+ * */
+class StringTable
+{
+public:
+    StringTable() : Size(0), Blocks()
+    {
+    }
+
+    ~StringTable()
+    {
+        for (string* pBlock : Blocks)
+            delete[] pBlock;
+    }
+
+    uint32_t Intern(const string& String)
+    {
+        lock_guard<mutex> Guard(Lock);
+        auto iter = Ids.find(String);
+        if (iter != Ids.end())
+            return iter->second;
+
+        uint32_t Id = Size++;
+        string*& pBlock = Blocks[Id / BLOCK_SIZE];
+        if (!pBlock)
+            pBlock = new string[BLOCK_SIZE];
+        pBlock[Id % BLOCK_SIZE] = String;
+        Ids.emplace(String, Id);
+        return Id;
+    }
+
+    bool Find(const string& String, uint32_t& Id)
+    {
+        lock_guard<mutex> Guard(Lock);
+        auto iter = Ids.find(String);
+        if (iter == Ids.end())
+            return false;
+
+        Id = iter->second;
+        return true;
+    }
+
+    const string& Get(uint32_t Id) const
+    {
+        return Blocks[Id / BLOCK_SIZE][Id % BLOCK_SIZE];
+    }
+
+private:
+    static const uint32_t BLOCK_SIZE = 4096;
+    static const uint32_t MAX_BLOCKS = 4096;
+
+    uint32_t Size;
+    string* Blocks[MAX_BLOCKS];
+    unordered_map<string, uint32_t> Ids;
+    mutex Lock;
+};
+
+extern StringTable sStringTable;
+
+// Superinstructions, dispatched in place of the first instruction of a fused sequence
+enum
+{
+    MAGIC_FUSED_COMPARE_BRANCH = MAGIC_UNK119 + 1,
+    MAGIC_FUSED_ASSIGN_LITERAL,
+    MAGIC_FUSED_ARITH_ASSIGN,
+    MAGIC_FUSED_INCREMENT,
+    MAGIC_FUSED_END
+};
+
+static const uint16_t MAGIC_FUSED_BEGIN = MAGIC_FUSED_COMPARE_BRANCH;
+static const uint16_t NUM_FUSED = MAGIC_FUSED_END - MAGIC_FUSED_BEGIN;
+
+// Handlers of expression statements (see Expression), counting and compiled
+enum
+{
+    MAGIC_PROFILE_EXPRESSION = MAGIC_FUSED_END,
+    MAGIC_COMPILED_EXPRESSION,
+    MAGIC_HANDLER_END
+};
+
+class Line;
+struct Instruction
+{
+    enum
+    {
+        OPERAND_NONE = 0,
+        OPERAND_INT = 1,
+        OPERAND_FLOAT = 2,
+        OPERAND_STRING = 3
+    };
+
+    uint16_t Magic;
+    // Magic, or a MAGIC_FUSED_* superinstruction covering the following lines
+    uint16_t Handler;
+    uint16_t NumParams;
+    uint8_t Type;
+    union
+    {
+        int32_t Int;
+        float Float;
+        // Call site cache slot for MAGIC_CALL_*
+        uint32_t Site;
+    };
+    // Interned literal string for MAGIC_LITERAL, first parameter otherwise
+    uint32_t Str;
+    // Index of the first interned parameter in CompiledScript::ParamIds
+    uint32_t Operands;
+    Line* pLine;
+    // Index in CompiledScript::Expressions for the expression handlers
+    uint32_t Expr;
+};
+
+class CompiledScript;
+struct CallSite
+{
+    CompiledScript* pScript;
+    uint32_t CodeLine;
+    uint32_t Generation;
+};
+
+// Source of a script restored from the script cache instead of a ScriptFile
+struct ScriptImage
+{
+    ~ScriptImage();
+
+    string Name;
+    vector<string> Includes;
+    unordered_map<string, uint32_t> Symbols;
+    // Indexed by line number, nullptr if there is no line 0
+    vector<Line*> Lines;
+};
+
+class ScriptFile;
+class CompiledScript
+{
+public:
+    CompiledScript(ScriptFile* pScript);
+    CompiledScript(ScriptImage* pImage);
+    ~CompiledScript();
+
+    Instruction* GetInstruction(uint32_t LineNumber)
+    {
+        return LineNumber < Code.size() ? &Code[LineNumber] : nullptr;
+    }
+
+    uint32_t GetParamId(Instruction* pInstr, uint32_t Index)
+    {
+        return ParamIds[pInstr->Operands + Index];
+    }
+
+    // Line of the label named by a branch parameter, resolved at load time
+    uint32_t GetTarget(Instruction* pInstr, uint32_t Index)
+    {
+        return Targets[pInstr->Operands + Index];
+    }
+
+    CallSite& GetCallSite(Instruction* pInstr)
+    {
+        return CallSites[pInstr->Site];
+    }
+
+    const string& GetName();
+    uint32_t GetSymbol(const string& Symbol);
+    const vector<string>& GetIncludes();
+
+    Expression& GetExpression(Instruction* pInstr)
+    {
+        return Expressions[pInstr->Expr];
+    }
+
+    static bool EnableFusion;
+    static atomic<uint32_t> FusedSites[NUM_FUSED];
+    static bool EnableExpressions;
+    static atomic<uint32_t> ExpressionSites;
+
+private:
+    void Compile();
+    Line* GetSourceLine(uint32_t LineNumber);
+    void Decode(Instruction& Instr, Line* pLine);
+    void Link();
+    void Fuse();
+    uint16_t Match(uint32_t Index);
+    void FindExpressions();
+
+    // One of these is the source
+    ScriptFile* pScript;
+    ScriptImage* pImage;
+    vector<Instruction> Code;
+    vector<uint32_t> ParamIds;
+    vector<uint32_t> Targets;
+    vector<CallSite> CallSites;
+    vector<Expression> Expressions;
+};
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef CONSTANT_CACHE_HPP
+#define CONSTANT_CACHE_HPP
+
+#include "Variable.hpp"
+#include "nsbconstants.hpp"
+
+/*
+ * Result of a constant lookup, resolved once per interned string. Strings
+ * built at runtime have no id and are looked up every time. Every thread
+ * has its own cache, so engines on different threads don't share one.
+ * */
+template <int32_t (*Resolve)(const string&)>
+class ConstantCache
+{
+    struct Entry
+    {
+        int32_t Val;
+        bool Resolved;
+    };
+public:
+    static int32_t Get(const Value& Val)
+    {
+        const Value& Str = Val.Deref();
+        if (Str.Tag != Value::NSB_STRING)
+            return Resolve(Str.ToString());
+        if (Str.Id == Value::NO_ID)
+            return Resolve(*Str.pStr);
+
+        if (Str.Id >= Entries.size())
+            Entries.resize(Str.Id + 1, {0, false});
+
+        Entry& Cached = Entries[Str.Id];
+        if (!Cached.Resolved)
+            Cached = {Resolve(*Str.pStr), true};
+        return Cached.Val;
+    }
+
+private:
+    static thread_local vector<Entry> Entries;
+};
+
+template <int32_t (*Resolve)(const string&)>
+thread_local vector<typename ConstantCache<Resolve>::Entry> ConstantCache<Resolve>::Entries;
+
+typedef ConstantCache<Nsb::ConstantToValue<Nsb::Boolean>> BooleanCache;
+
+#endif
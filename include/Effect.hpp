@@ -21,13 +21,18 @@
 #include <GL/glew.h>
 #include <png.h>
 #include "Texture.hpp"
+#include "EngineContext.hpp"
 #include "nsbconstants.hpp"
 
+/*
+ * Programs are compiled the first time an effect needs them and kept by
+ * the engine, so creating an effect on a hot path (every fade of a text
+ * box) costs a lookup. They are freed with the window's GL context.
+ * */
 class Effect
 {
 public:
     Effect() : Program(0) { }
-    ~Effect() { glDeleteObjectARB(Program); }
 
 protected:
     int32_t Lerp(int32_t Old, int32_t New, float Progress)
@@ -43,6 +48,13 @@ protected:
         if (!GLEW_ARB_fragment_shader)
             return;
 
+        uint32_t& Shared = sEngine->Programs[String];
+        if (Shared)
+        {
+            Program = Shared;
+            return;
+        }
+
         GLuint Shader = glCreateShaderObjectARB(GL_FRAGMENT_SHADER_ARB);
         glShaderSourceARB(Shader, 1, &String, NULL);
         glCompileShaderARB(Shader);
@@ -52,6 +64,7 @@ protected:
 
         glLinkProgramARB(Program);
         glDeleteObjectARB(Shader);
+        Shared = Program;
     }
 
     GLuint Program;
@@ -144,6 +157,11 @@ public:
         Reset(this->EndX, EndX, this->EndY, EndY, Time);
     }
 
+    bool IsDone()
+    {
+        return ElapsedTime >= Time;
+    }
+
     float GetProgress()
     {
         if (ElapsedTime >= Time)
@@ -265,6 +283,10 @@ class MaskEffect : public FadeEffect, GLTexture
         "   gl_FragColor = Pixel;"
         "}";
 public:
+    // GLTexture is a private base, keep allocating from the object pool
+    using GLTexture::operator new;
+    using GLTexture::operator delete;
+
     MaskEffect(const string& Filename, int32_t StartOpacity, int32_t EndOpacity, int32_t Time, int32_t Boundary)
     {
         CompileShader(MaskShader.c_str());
@@ -275,17 +297,26 @@ public:
     {
         CreateFromFile(Filename, true);
         LerpEffect::Reset(StartOpacity, EndOpacity, 0, 0, Time);
+        this->Boundary = Boundary;
+    }
+
+    // The program is shared, so the uniforms of this mask are set on every draw
+    void OnDraw(int32_t diff)
+    {
+        FadeEffect::OnDraw(diff);
 
         if (!Program)
             return;
 
-        glUseProgramObjectARB(Program);
         glActiveTextureARB(GL_TEXTURE1_ARB);
         glBindTexture(GL_TEXTURE_2D, GLTextureID);
         glUniform1iARB(glGetUniformLocationARB(Program, "Mask"), 1);
         glActiveTextureARB(GL_TEXTURE0_ARB);
         glUniform1fARB(glGetUniformLocationARB(Program, "Boundary"), Boundary * 0.001f);
     }
+
+private:
+    int32_t Boundary;
 };
 
 class BlurEffect : public Effect, GLTexture
@@ -314,6 +345,9 @@ class BlurEffect : public Effect, GLTexture
         "   gl_FragColor = Average / CoeffSum;"
         "}";
 public:
+    using GLTexture::operator new;
+    using GLTexture::operator delete;
+
     BlurEffect() : Framebuffer(GL_INVALID_VALUE)
     {
     }
@@ -330,10 +364,7 @@ public:
         if (!Program)
             return false;
 
-        glUseProgramObjectARB(Program);
-        glUniform1fARB(glGetUniformLocationARB(Program, "Sigma"), Sigma);
-        glUniform1iARB(glGetUniformLocationARB(Program, "Texture"), 0);
-
+        this->Sigma = Sigma;
         glGenFramebuffers(1, &Framebuffer);
         glBindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
         CreateEmpty(Width, Height);
@@ -352,6 +383,8 @@ public:
     void OnDraw(GLTexture* pTexture, float* xa, float* ya, float Width, float Height)
     {
         glUseProgramObjectARB(Program);
+        glUniform1fARB(glGetUniformLocationARB(Program, "Sigma"), Sigma);
+        glUniform1iARB(glGetUniformLocationARB(Program, "Texture"), 0);
 
         // Switch to FBO
         glBindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
@@ -381,6 +414,7 @@ public:
     }
 
     GLuint Framebuffer;
+    float Sigma;
 };
 
 #endif
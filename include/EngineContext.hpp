@@ -0,0 +1,88 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef ENGINE_CONTEXT_HPP
+#define ENGINE_CONTEXT_HPP
+
+#include "ObjectTable.hpp"
+#include "ObjectPool.hpp"
+#include "StartupTimeline.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+class ResourceMgr;
+class Window;
+class Playable;
+
+// Defaults of new text objects, set by the SetFont builtin
+struct TextStyle
+{
+    string Font;
+    int32_t Size;
+    uint32_t InColor;
+    uint32_t OutColor;
+    int32_t Weight;
+    string Align;
+};
+
+/*
+ * State of one engine: a Window, its NSBInterpreter and the thread running
+ * them. Several engines may run side by side in one process, each on its
+ * own thread. The context is created on that thread before the Window and
+ * becomes current there; objects remember the context they were created
+ * in, so callbacks from other threads (gstreamer) reach the right engine.
+ * */
+class EngineContext
+{
+public:
+    // Takes ownership of pResourceMgr
+    EngineContext(ResourceMgr* pResourceMgr);
+    ~EngineContext();
+
+    // Make this the engine of the calling thread
+    void MakeCurrent();
+    void PlayVoice(const string& Filename);
+
+    // Declared first so it is destroyed after everything that may own objects
+    ObjectPool Pool;
+    StartupTimeline Timeline;
+    ResourceMgr* pResourceMgr;
+    Window* pWindow;
+    TextStyle DefaultText;
+    ObjectTable Objects;
+    // Shader programs by source, shared by all effects of the window's GL context
+    unordered_map<string, uint32_t> Programs;
+
+    // Objects notified from other threads, see Object::Post
+    mutex PostedLock;
+    vector<Object*> Posted;
+
+private:
+    Playable* pVoice;
+    // Scans the gstreamer registry while the window and scripts load
+    thread GStreamerInit;
+};
+
+// Engine of the calling thread
+extern thread_local EngineContext* sEngine;
+
+#endif
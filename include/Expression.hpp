@@ -0,0 +1,86 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef EXPRESSION_HPP
+#define EXPRESSION_HPP
+
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+struct Instruction;
+class VariableTable;
+
+struct ExpressionStats
+{
+    // Sequences which may be compiled, found at load time
+    uint32_t Sites;
+    // Sequences which ran often enough to be compiled
+    uint32_t Compiled;
+    uint64_t Hits;
+    uint64_t Fallbacks;
+    // Sequences left to the interpreter because the compiled result differed
+    uint32_t Mismatches;
+};
+
+/*
+ * A statement made of integer literals, variable loads and arithmetic,
+ * comparison and logical operators, ending in an assignment, if or while.
+ * Once the statement has run Threshold times it is compiled into a list
+ * of nodes which compute into integer registers instead of pushing every
+ * intermediate Value through the parameter stack. The register of a node
+ * is the stack slot its result would have occupied, so operand order is
+ * the same as in the interpreter. The statement is only switched over
+ * after one run where the interpreter produced the same integer.
+ *
+ * Compiled code only handles integers: if a variable holds anything else
+ * or a division by zero would happen, Evaluate fails and the interpreter
+ * runs the original instructions instead.
+ * */
+class Expression
+{
+    struct Node
+    {
+        uint16_t Magic;
+        uint8_t Dest;
+        // Literal value for MAGIC_LITERAL, variable id for MAGIC_VARIABLE
+        int32_t Operand;
+    };
+public:
+    Expression(uint32_t Length);
+
+    // Number of instructions (including the terminator) of the statement starting at pInstr, or 0
+    static uint32_t Scan(Instruction* pInstr, uint32_t Left);
+
+    void Compile(Instruction* pInstr);
+    bool Evaluate(VariableTable& Variables, int32_t& Result);
+    bool IsCompiled() { return !Nodes.empty(); }
+    uint32_t GetLength() { return Length; }
+
+    // Executions of the statement before it got compiled
+    uint32_t Count;
+
+    static uint32_t Threshold;
+
+private:
+    static const uint8_t MAX_DEPTH = 16;
+
+    uint32_t Length;
+    vector<Node> Nodes;
+};
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef FORMATTER_HPP
+#define FORMATTER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+using namespace std;
+
+struct Value;
+
+/*
+ * printf style format string for the String() builtin, parsed once into
+ * literal chunks and placeholders. Output matches boost::format for the
+ * directives scripts use (flags, width, precision, d i u s x X o f e g and
+ * %N% / %N$ positional arguments). Anything else is reported as invalid so
+ * the caller can fall back to boost::format.
+ * */
+class Formatter
+{
+    struct Op
+    {
+        // Argument index, or NO_ARG for a literal chunk
+        uint32_t Arg;
+        // Literal chunk, or printf flags, width and precision of a placeholder
+        string Text;
+        char Conversion;
+        int32_t Width;
+        int32_t Precision;
+        bool Left;
+    };
+public:
+    Formatter(const string& Format);
+
+    bool IsValid() { return Valid; }
+    void Format(const vector<Value>& Args, string& Out);
+
+    // Cached formatter for an interned format string, nullptr if there is none
+    static Formatter* Get(const Value& Format);
+
+private:
+    bool Parse(const string& Format);
+    void AppendNumber(const Op& Placeholder, const Value& Val, string& Out);
+    void AppendString(const Op& Placeholder, const string& Str, string& Out);
+
+    static const uint32_t NO_ARG = UINT32_MAX;
+    // Per thread, see ConstantCache
+    static thread_local vector<unique_ptr<Formatter>> Cache;
+
+    vector<Op> Ops;
+    bool Valid;
+};
+
+#endif
@@ -31,6 +31,9 @@ public:
     GLTexture();
     virtual ~GLTexture();
 
+    static const uint16_t TYPE = OBJECT_GLTEXTURE;
+    static GLTexture* Cast(Object* pObject) { return pObject->pGLTexture; }
+
     void Draw(int X, int Y, const string& Filename);
     void Draw(float X, float Y, float Width, float Height);
     void Draw(const float* xa, const float* ya);
@@ -27,6 +27,9 @@ public:
     Image();
     ~Image();
 
+    static const uint16_t TYPE = OBJECT_IMAGE;
+    static Image* Cast(Object* pObject) { return static_cast<Image*>(pObject); }
+
     GLenum GetFormat() const { return Format; }
     int GetWidth() const { return Width; }
     int GetHeight() const { return Height; }
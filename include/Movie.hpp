@@ -29,7 +29,11 @@ public:
     Movie(const string& FileName, Window* pWindow, int32_t Priority, bool Alpha, bool Audio);
     ~Movie();
 
+    static const uint16_t TYPE = OBJECT_MOVIE;
+    static Movie* Cast(Object* pObject) { return static_cast<Movie*>(pObject->pPlayable); }
+
     virtual void Request(int32_t State) { Playable::Request(State); }
+    virtual bool Action() { return Playable::Action(); }
     void Draw(uint32_t Diff);
 private:
     void InitVideo(Window* pWindow);
@@ -20,33 +20,53 @@
 
 #include "Object.hpp"
 #include <stack>
+#include <list>
+#include <map>
 #include <cstdint>
 
-class ScriptFile;
+class CompiledScript;
+struct Instruction;
 class Line;
 class Text;
 class NSBContext : public Object
 {
+    friend class Scheduler;
     struct StackFrame
     {
-        ScriptFile* pScript;
+        CompiledScript* pScript;
         uint32_t SourceLine;
     };
+    struct SchedulerEntry
+    {
+        SchedulerEntry() : InThreads(false), InReady(false), InWait(false), InClick(false), InTimer(false) { }
+        list<NSBContext*>::iterator Thread, Ready, Click;
+        multimap<Object*, NSBContext*>::iterator Wait;
+        multimap<uint64_t, NSBContext*>::iterator Timer;
+        bool InThreads, InReady, InWait, InClick, InTimer;
+    };
 public:
     NSBContext(const string& Name);
     ~NSBContext();
 
-    bool Call(ScriptFile* pScript, const string& Symbol);
-    void Jump(const string& Symbol);
+    static const uint16_t TYPE = OBJECT_CONTEXT;
+    static NSBContext* Cast(Object* pObject) { return static_cast<NSBContext*>(pObject); }
+
+    bool Call(CompiledScript* pScript, const string& Symbol);
+    void Call(CompiledScript* pScript, uint32_t CodeLine);
+    void Jump(uint32_t CodeLine);
+    void JumpParam(uint32_t Index);
     void Break();
     const string& GetParam(uint32_t Index);
+    uint32_t GetParamId(uint32_t Index);
     int GetNumParams();
     const string& GetScriptName();
-    ScriptFile* GetScript();
+    CompiledScript* GetScript();
+    Instruction* GetInstruction();
     Line* GetLine();
     uint32_t GetLineNumber();
+    size_t GetCallDepth();
     uint32_t GetMagic();
-    uint32_t Advance();
+    Instruction* Advance();
     void Rewind();
     void Return();
     void PushBreak();
@@ -56,7 +76,6 @@ public:
     void WaitKey(int32_t Time);
     void Wait(int32_t Time, bool Interrupt = false);
     void Wake();
-    void TryWake();
     void OnClick();
     bool IsStarving();
     bool IsSleeping();
@@ -65,20 +84,23 @@ public:
     void Request(int32_t State);
     const string& GetName();
     void WriteTrace(ostream& Stream);
-    void Update(uint32_t Diff);
 
 private:
     StackFrame* GetFrame();
 
-    Text* pText;
-    Object* pObject;
+    Text* GetWaitText();
+    Object* GetWaitObject();
+
+    // Handles, the objects may be deleted while the thread waits on them
+    uint32_t TextHandle;
+    uint32_t ObjectHandle;
     const string Name;
     uint64_t WaitTime;
-    uint64_t Elapsed;
     bool WaitInterrupt;
     bool Active;
     stack<StackFrame> CallStack;
-    stack<string> BreakStack;
+    stack<uint32_t> BreakStack;
+    SchedulerEntry Sched;
 };
 
 #endif
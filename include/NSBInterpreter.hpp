@@ -19,41 +19,54 @@
 #define NSB_INTERPRETER_HPP
 
 #include "Variable.hpp"
+#include "VariableTable.hpp"
+#include "Scheduler.hpp"
 #include "Choice.hpp"
+#include "Expression.hpp"
 #include <SDL2/SDL.h>
 #include <functional>
 #include <queue>
+#include <deque>
 #include <thread>
+#include <mutex>
+#include <atomic>
 #include <list>
+#include <limits>
 using namespace std;
 
 class Stack
 {
 public:
-    Stack() : ReadIndex(0), WriteIndex(0)
+    Stack() : ReadIndex(0), WriteIndex(0), NumStrings(0)
     {
     }
 
-    void Push(Variable* pVar)
+    void Push(const Value& Val)
     {
         if (WriteIndex == Params.size())
-            Params.push_back(pVar);
+            Params.push_back(Val);
         else
-            Params[WriteIndex] = pVar;
+            Params[WriteIndex] = Val;
         WriteIndex++;
     }
 
-    Variable* Top()
+    const Value& Top()
     {
         return Params[ReadIndex];
     }
 
-    Variable* TTop()
+    const Value& TTop()
     {
         return Params[ReadIndex + 1];
     }
 
-    Variable* Pop()
+    // Last pushed value
+    const Value& Back()
+    {
+        return Params[WriteIndex - 1];
+    }
+
+    Value Pop()
     {
         return Params[ReadIndex++];
     }
@@ -64,25 +77,71 @@ public:
         ReadIndex = WriteIndex;
     }
 
+    // Scratch string which stays valid until the next Reset()
+    string& NewString()
+    {
+        if (NumStrings == Strings.size())
+            Strings.emplace_back();
+        string& Str = Strings[NumStrings++];
+        Str.clear();
+        return Str;
+    }
+
     void Reset()
     {
-        ReadIndex = WriteIndex = 0;
-        Params.clear();
+        ReadIndex = WriteIndex = NumStrings = 0;
     }
 
 private:
-    vector<Variable*> Params;
+    vector<Value> Params;
+    deque<string> Strings;
     size_t ReadIndex;
     size_t WriteIndex;
+    size_t NumStrings;
 };
 
-typedef function<int32_t(int32_t)> PosFunc;
 struct NSBPosition
 {
-    NSBPosition() : Func(nullptr) { }
-    PosFunc Func;
+    // Position of an object of size xy, Extent is the window width or height
+    enum
+    {
+        IMMEDIATE, // Int
+        OUT_START, // -xy
+        OUT_END, // Extent
+        START, // 0
+        IN_END, // Extent - xy
+        ON_START, // -xy / 2
+        ON_END, // Extent - xy / 2
+        END, // xy
+        CENTER, // (Extent - xy) / 2
+        AUTO
+    };
+
+    NSBPosition() : Kind(IMMEDIATE), Relative(false), Int(0) { }
+
+    int32_t Eval(int32_t xy)
+    {
+        switch (Kind)
+        {
+            case OUT_START: return -xy;
+            case OUT_END: return Int;
+            case START: return 0;
+            case IN_END: return Int - xy;
+            case ON_START: return -(xy / 2);
+            case ON_END: return Int - (xy / 2);
+            case END: return xy;
+            case CENTER: return (Int - xy) / 2;
+            case AUTO: return numeric_limits<int32_t>::max();
+        }
+        return Int;
+    }
+
+    int32_t operator()(int32_t xy, int32_t Old = 0) { return Relative ? Old + Eval(xy) : Eval(xy); }
+
+    uint8_t Kind;
     bool Relative;
-    int32_t operator()(int32_t xy, int32_t Old = 0) { return Relative ? Old + Func(xy) : Func(xy); }
+    // Immediate value, or the extent for kinds aligned to the far edge
+    int32_t Int;
 };
 
 class Line;
@@ -91,6 +150,7 @@ class Texture;
 class Playable;
 class Scrollbar;
 class NSBContext;
+struct CallSite;
 class NSBInterpreter
 {
     struct NSBFunction
@@ -118,7 +178,14 @@ public:
     virtual void HandleEvent(const SDL_Event& Event);
     void Update(uint32_t Diff);
     void Run(int NumCommands);
+    void RunFor(uint32_t Budget);
     void RunCommand();
+    void SetQuota(uint32_t Quota);
+    ExpressionStats GetExpressionStats();
+
+    // Run Hook after every assignment to the variable Name
+    uint32_t Watch(const string& Name, VariableHook Hook);
+    void Unwatch(const string& Name, uint32_t Hook);
 
 protected:
     void FunctionDeclaration();
@@ -144,6 +211,12 @@ protected:
     void Literal();
     void Assign();
     void Get();
+    void FusedCompareBranch();
+    void FusedAssignLiteral();
+    void FusedArithAssign();
+    void FusedIncrement();
+    void ProfileExpression();
+    void CompiledExpression();
     void ScopeBegin();
     void ScopeEnd();
     void Return();
@@ -261,6 +334,7 @@ protected:
     int32_t PopTempo();
     bool PopBool();
     string PopSave();
+    Value PopValue();
     Variable* PopVar();
     Texture* PopTexture();
     GLTexture* PopGLTexture();
@@ -271,65 +345,97 @@ protected:
     void PushInt(int32_t Int);
     void PushString(const string& Str);
     void PushVar(Variable* pVar);
+    void PushValue(const Value& Val);
     void Assign_(int Index);
+    Value AddValues(const Value& Lhs, const Value& Rhs);
 
-    void IntUnaryOp(function<int32_t(int32_t)> Func);
-    void IntBinaryOp(function<int32_t(int32_t, int32_t)> Func);
-    void FloatBinaryOp(function<float(float, float)> Func);
-    void BoolBinaryOp(function<bool(bool, bool)> Func);
+    template <class T> void IntUnaryOp(T Func);
+    template <class T> void IntBinaryOp(T Func);
+    template <class T> void FloatBinaryOp(T Func);
+    template <class T> void BoolBinaryOp(T Func);
+    template <template <class> class T> void NumericBinaryOp();
 
     void SetInt(const string& Name, int32_t Val);
     void SetString(const string& Name, const string& Val);
-    void SetVar(const string& Name, Variable* pVar);
-    virtual void OnVariableChanged(const string& Name);
+    void SetVar(const string& Name, const Value& Val);
+    void SetVar(uint32_t Id, const Value& Val);
     int32_t GetInt(const string& Name);
     string GetString(const string& Name);
     bool GetBool(const string& Name);
-    bool ToBool(Variable* pVar);
+    bool ToBool(const Value& Val);
     Variable* GetVar(const string& Name);
+    Variable* GetVar(uint32_t Id);
     Object* GetObject(const string& Name);
     template <class T> T* Get(const string& Name);
     void CallFunction_(NSBContext* pThread, const string& Symbol);
+    bool CallCached(CallSite& Site);
+    void CacheCall(CallSite& Site, size_t Depth);
     void CallScriptSymbol(const string& Prefix);
     void CallScript(const string& Filename, const string& Symbol);
     void CallScriptThread(const string& Filename, const string& Symbol);
     void Call(uint16_t Magic);
+    void CallUnfused(uint32_t Count);
     bool SelectEvent();
     void AddThread(NSBContext* pThread);
     void RemoveThread(NSBContext* pThread);
-    void ProcessKey(int Key, const string& Val);
-    void ProcessButton(int button, const string& Val);
+    void InitInput();
+    void SetInput(Variable* pVar, bool Down);
+    void ProcessKey(SDL_Keycode Key, bool Down);
+    void ProcessButton(int button, bool Down);
 
     void DebuggerMain();
     void Inspect(int32_t n);
     void DbgBreak(bool Break);
     void DebuggerTick();
+    void DbgQueue(function<void()> Request);
+    void DbgRunRequests();
     void PrintVariable(Variable* pVar);
+    void PrintFusionStats();
+    void PrintExpressionStats();
     void SetBreakpoint(const string& Script, int32_t LineNumber);
+    void SetWatchpoint(const string& Name);
+    void ClearWatchpoints();
     thread* pDebuggerThread;
     bool LogCalls;
     bool DbgStepping;
     bool RunInterpreter;
     list<pair<string, uint32_t>> Breakpoints;
+    map<string, uint32_t> Watchpoints;
+    // Debugger commands which touch interpreter state, run on the interpreter thread
+    mutex DbgLock;
+    vector<function<void()>> DbgRequests;
+    atomic<bool> DbgPending;
+    vector<uint64_t> FusionHits;
+    vector<uint64_t> FusionMisses;
+    ExpressionStats Expressions;
 
     bool SkipHack;
-    bool ThreadsModified;
     SDL_Event Event;
     queue<SDL_Event> Events;
     Window* pWindow;
+    EngineContext* pEngine;
     NSBContext* pContext;
     vector<NSBFunction> Builtins;
     Stack Params;
     vector<NSBShortcut> Shortcuts;
     vector<ScriptFile*> Scripts;
-    list<NSBContext*> Threads;
-    Holder<Variable> VariableHolder;
+    Scheduler Threads;
+    vector<Value> FormatArgs;
+    // $SYSTEM_keydown_* variables indexed by KeyIndex
+    vector<Variable*> KeyVariables;
+    Variable* pLeftButton;
+    Variable* pRightButton;
+    uint32_t TrueId;
+    uint32_t FalseId;
+    uint32_t Quota;
+    VariableTable Variables;
+    uint32_t ArrayVariableId;
     ObjectHolder_t ObjectHolder;
 };
 
 template <class T> T* NSBInterpreter::Get(const string& Name)
 {
-    return dynamic_cast<T*>(GetObject(Name));
+    return ObjectHolder.ReadAs<T>(Name);
 }
 
 #endif
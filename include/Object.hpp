@@ -20,23 +20,29 @@
 
 #include "ResourceMgr.hpp"
 #include "nsbconstants.hpp"
-#include <regex>
+#include "EngineContext.hpp"
+#include "ObjectPool.hpp"
+#include <cassert>
+#include <vector>
+#include <unordered_map>
 
 class Object;
 class ObjectHolder_t : private Holder<Object>
 {
 public:
+    ObjectHolder_t(bool Root = true) : Root(Root)
+    {
+    }
+
     virtual ~ObjectHolder_t()
     {
     }
 
     Object* Read(const string& Handle)
     {
-        string Leftover = Handle;
-        string ObjHandle = ExtractObjHandle(Leftover);
-        if (Leftover.empty())
-            return Holder::Read(ObjHandle);
-        return GetHolder(ObjHandle)->Read(Leftover);
+        if (Object** ppObject = Resolve(Handle))
+            return *ppObject;
+        return nullptr;
     }
 
     void Write(const string& Handle, Object* pObject)
@@ -44,9 +50,18 @@ public:
         string Leftover = Handle;
         string ObjHandle = ExtractObjHandle(Leftover);
         if (Leftover.empty())
+        {
+            // Children of a replaced object go away with it
+            Object** ppOld = ReadPointer(ObjHandle);
+            if (ppOld && *ppOld)
+                Invalidate();
             Holder::Write(ObjHandle, pObject);
-        else
-            GetHolder(ObjHandle)->Write(Leftover, pObject);
+        }
+        else if (ObjectHolder_t* pHolder = GetHolder(ObjHandle))
+        {
+            Invalidate();
+            pHolder->Write(Leftover, pObject);
+        }
     }
 
     void Delete(const string& Handle)
@@ -54,9 +69,15 @@ public:
         Write(Handle, nullptr);
     }
 
+    template <class T>
+    T* ReadAs(const string& Handle);
+
     template <class F>
     void Execute(const string& Handle, F Func)
     {
+        if (Handle.find('*') == string::npos)
+            return CallSafe(Resolve(Handle), Func);
+
         string Leftover = Handle;
         string ObjHandle = ExtractObjHandle(Leftover);
         if (ObjHandle.back() == '*')
@@ -65,12 +86,55 @@ public:
             Leftover.empty() ? CallSafe(ReadPointer(ObjHandle), Func) : ExecuteSafe(ObjHandle, Leftover, Func);
     }
 
+    // Execute on the objects of type T only
+    template <class T, class F>
+    void ExecuteAs(const string& Handle, F Func);
+
     void WriteAlias(const string& Handle, const string& Alias)
     {
         Aliases[Alias] = Handle;
+        Invalidate();
+    }
+
+    // Must be called when an object is deleted without going through Write
+    void Invalidate()
+    {
+        Resolved.clear();
     }
 
 private:
+    /*
+     * Slot of a handle without wildcards. Slots are never erased from the
+     * holders, so they stay valid until an object which could own them is
+     * replaced or an alias changes. Only the root holder caches them: it is
+     * the one invalidated when objects are deleted, children are walked.
+     * */
+    Object** Resolve(const string& Handle)
+    {
+        if (!Root)
+            return Lookup(Handle);
+
+        auto iter = Resolved.find(Handle);
+        if (iter != Resolved.end())
+            return iter->second;
+
+        Object** ppObject = Lookup(Handle);
+        if (ppObject)
+            Resolved.emplace(Handle, ppObject);
+        return ppObject;
+    }
+
+    Object** Lookup(const string& Handle)
+    {
+        string Leftover = Handle;
+        string ObjHandle = ExtractObjHandle(Leftover);
+        if (Leftover.empty())
+            return ReadPointer(ObjHandle);
+        if (ObjectHolder_t* pHolder = GetHolder(ObjHandle))
+            return pHolder->Lookup(Leftover);
+        return nullptr;
+    }
+
     template <class F>
     void CallSafe(Object** ppObject, F Func)
     {
@@ -85,27 +149,26 @@ private:
             pHolder->Execute(Handle, Func);
     }
 
+    // Both maps are sorted, so a prefix* wildcard is a range starting at the prefix
     template <class F>
     void WildcardAlias(const string& Leftover, const string& ObjHandle, F Func)
     {
-        std::regex Regex(Regexify(ObjHandle.substr(1)));
-        for (auto i = Aliases.begin(); i != Aliases.end(); ++i)
-            if (std::regex_match(i->first, Regex))
-                Leftover.empty() ? Execute(i->second, Func) : ExecuteSafe(i->second, Leftover, Func);
+        string Prefix = ObjHandle.substr(1, ObjHandle.size() - 2);
+        for (auto i = Aliases.lower_bound(Prefix); i != Aliases.end() && HasPrefix(i->first, Prefix); ++i)
+            Leftover.empty() ? Execute(i->second, Func) : ExecuteSafe(i->second, Leftover, Func);
     }
 
     template <class F>
     void WildcardCache(const string& Leftover, const string& ObjHandle, F Func)
     {
-        std::regex Regex(Regexify(ObjHandle));
-        for (auto i = Cache.begin(); i != Cache.end(); ++i)
-            if (std::regex_match(i->first, Regex))
-                Leftover.empty() ? CallSafe(&i->second, Func) : ExecuteSafe(i->first, Leftover, Func);
+        string Prefix = ObjHandle.substr(0, ObjHandle.size() - 1);
+        for (auto i = Cache.lower_bound(Prefix); i != Cache.end() && HasPrefix(i->first, Prefix); ++i)
+            Leftover.empty() ? CallSafe(&i->second, Func) : ExecuteSafe(i->first, Leftover, Func);
     }
 
-    string Regexify(const string& Wildcard)
+    static bool HasPrefix(const string& String, const string& Prefix)
     {
-        return string("^" + Wildcard.substr(0, Wildcard.size() - 1) + ".*");
+        return String.compare(0, Prefix.size(), Prefix) == 0;
     }
 
     string ExtractObjHandle(string& Handle)
@@ -138,16 +201,58 @@ private:
     }
 
     map<string, string> Aliases;
+    unordered_map<string, Object**> Resolved;
+    bool Root;
+};
+
+class ObjectListener
+{
+public:
+    virtual ~ObjectListener()
+    {
+    }
+    // Object may have finished its action, Action() tells whether it did
+    virtual void OnAction(Object* pObject) = 0;
+    // Object is being destroyed, its Action() can no longer be called
+    virtual void OnDestroy(Object* pObject) = 0;
 };
 
-class Window;
+// Type bits of Object subclasses, objects also carry the bits of their bases
+enum
+{
+    OBJECT_GLTEXTURE = 1 << 0,
+    OBJECT_TEXTURE = 1 << 1,
+    OBJECT_TEXT = 1 << 2,
+    OBJECT_PLAYABLE = 1 << 3,
+    OBJECT_MOVIE = 1 << 4,
+    OBJECT_IMAGE = 1 << 5,
+    OBJECT_SCROLLBAR = 1 << 6,
+    OBJECT_CHOICE = 1 << 7,
+    OBJECT_CONTEXT = 1 << 8
+};
+
+class GLTexture;
+class Playable;
 struct Object : ObjectHolder_t
 {
-    Object() : Lock(false)
+    // Objects belong to the engine of the thread creating them, which must have one
+    Object() : ObjectHolder_t(false), Lock(false), Types(0), pGLTexture(nullptr), pPlayable(nullptr), pEngine(sEngine), Posted(false)
     {
+        assert(pEngine);
+        Handle = pEngine->Objects.Add(this);
     }
-    virtual ~Object()
+    Object(const Object&) = delete;
+    Object& operator=(const Object&) = delete;
+    virtual ~Object();
+
+    static void* operator new(size_t Size)
     {
+        assert(sEngine);
+        return sEngine->Pool.Allocate(Size);
+    }
+    static void operator delete(void* pMemory, size_t Size)
+    {
+        ObjectPool::Free(pMemory, Size);
     }
     virtual void Request(int32_t State)
     {
@@ -161,8 +266,58 @@ struct Object : ObjectHolder_t
     {
         return false;
     }
+
+    void Listen(ObjectListener* pListener);
+    void Unlisten(ObjectListener* pListener);
+    void Notify();
+    // Notify from another thread, listeners run in DispatchPosted on the engine thread
+    void Post();
+    static void DispatchPosted();
+
+    // Typed view of the object, a bit test instead of a dynamic_cast
+    template <class T> T* As()
+    {
+        return (Types & T::TYPE) ? T::Cast(this) : nullptr;
+    }
+
+    // Object of type T behind a handle, nullptr if it was destroyed since
+    template <class T> static T* FromHandle(uint32_t Handle)
+    {
+        Object* pObject = sEngine->Objects.Get(Handle);
+        return pObject ? pObject->As<T>() : nullptr;
+    }
+    uint32_t GetHandle() { return Handle; }
+
     bool Lock;
-    static Window* pWindow;
+    uint16_t Types;
+    // Object is a virtual base of these, derived classes are reached from them
+    GLTexture* pGLTexture;
+    Playable* pPlayable;
+    // Engine the object was created in
+    EngineContext* pEngine;
+
+private:
+    vector<ObjectListener*> Listeners;
+    uint32_t Handle;
+    bool Posted;
 };
 
+template <class T>
+T* ObjectHolder_t::ReadAs(const string& Handle)
+{
+    Object* pObject = Read(Handle);
+    return pObject ? pObject->As<T>() : nullptr;
+}
+
+template <class T, class F>
+void ObjectHolder_t::ExecuteAs(const string& Handle, F Func)
+{
+    Execute(Handle, [&Func] (Object** ppObject)
+    {
+        if (*ppObject)
+            if (T* pObject = (*ppObject)->As<T>())
+                Func(pObject);
+    });
+}
+
 #endif
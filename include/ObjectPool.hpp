@@ -0,0 +1,67 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef OBJECT_POOL_HPP
+#define OBJECT_POOL_HPP
+
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+/*
+ * Slab allocator behind Object::operator new. Every object type has its
+ * own size, so each size class ends up being a pool for one or two types.
+ * Memory is carved out of slabs of SLAB_OBJECTS objects and freed objects
+ * go on a free list of their size class, so creating and destroying a few
+ * hundred objects at a scene transition reuses the same memory instead of
+ * going through the heap. Sizes above MAX_SIZE use the global allocator.
+ *
+ * Every engine has its own pool. A block starts with a pointer to the pool
+ * it came from, so an object deleted on another thread (engine teardown)
+ * still goes back to its own pool. An engine's objects are created and
+ * deleted by one thread at a time, so the pool takes no lock. Slabs are
+ * freed with the pool once all of its objects are gone.
+ * */
+class ObjectPool
+{
+    struct Node
+    {
+        Node* pNext;
+    };
+public:
+    ObjectPool();
+    ~ObjectPool();
+
+    void* Allocate(size_t Size);
+    static void Free(void* pMemory, size_t Size);
+
+private:
+    void Release(void* pBlock, size_t Class);
+
+    static const size_t GRANULARITY = 16;
+    // Keeps objects aligned as the global allocator would
+    static const size_t HEADER_SIZE = 16;
+    static const size_t MAX_SIZE = 2048;
+    static const size_t SLAB_OBJECTS = 32;
+    static const size_t NUM_CLASSES = MAX_SIZE / GRANULARITY;
+
+    Node* FreeLists[NUM_CLASSES];
+    vector<char*> Slabs;
+    size_t NumLive;
+};
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef OBJECT_TABLE_HPP
+#define OBJECT_TABLE_HPP
+
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+struct Object;
+
+/*
+ * Every live Object has a slot here. A handle is the slot index plus the
+ * generation of the slot, which is bumped when the object is destroyed,
+ * so a handle held past the object's lifetime resolves to nullptr instead
+ * of a dangling pointer. Freed slots are reused until their generation
+ * runs out, then they are retired. Every engine has its own table, used
+ * only from the engine's thread.
+ * */
+class ObjectTable
+{
+    struct Slot
+    {
+        Object* pObject;
+        uint32_t Generation;
+    };
+public:
+    static const uint32_t INVALID_HANDLE = 0;
+
+    uint32_t Add(Object* pObject);
+    void Remove(uint32_t Handle);
+
+    Object* Get(uint32_t Handle)
+    {
+        uint32_t Index = Handle & INDEX_MASK;
+        if (Index >= Slots.size() || Slots[Index].Generation != Handle >> INDEX_BITS)
+            return nullptr;
+        return Slots[Index].pObject;
+    }
+
+private:
+    static const uint32_t INDEX_BITS = 20;
+    static const uint32_t INDEX_MASK = (1 << INDEX_BITS) - 1;
+    static const uint32_t MAX_GENERATION = (1 << (32 - INDEX_BITS)) - 1;
+
+    vector<Slot> Slots;
+    vector<uint32_t> Free;
+};
+
+#endif
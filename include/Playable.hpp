@@ -22,6 +22,7 @@
 #include <gst/app/gstappsrc.h>
 #include "Object.hpp"
 #include "ResourceMgr.hpp"
+#include <atomic>
 
 struct AppSrc
 {
@@ -39,6 +40,11 @@ public:
     Playable(Resource Res);
     virtual ~Playable();
 
+    static const uint16_t TYPE = OBJECT_PLAYABLE;
+    static Playable* Cast(Object* pObject) { return pObject->pPlayable; }
+    // Called before any gstreamer use, blocks until the first caller has finished
+    static void InitGStreamer();
+
     void SetVolume(int32_t Time, int32_t Volume);
     void SetFrequency(int32_t Time, int32_t Frequency);
     void SetPan(int32_t Time, int32_t Pan);
@@ -50,6 +56,7 @@ public:
     int32_t DurationTime();
     int32_t PassageTime();
     void OnEOS();
+    void OnError(GstMessage* Msg);
     void Request(int32_t State);
     virtual bool Action();
 
@@ -61,6 +68,8 @@ protected:
     GstElement* Pipeline;
     bool Playing;
 private:
+    // True unless playing, set from the streaming thread on EOS and errors
+    atomic<bool> Finished;
     bool Loop;
     GstElement* AudioBin;
     GstElement* VolumeFilter;
@@ -20,11 +20,23 @@
 
 #include <vector>
 #include <map>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <algorithm>
+#include <functional>
 #include "inpafile.hpp"
 using namespace std;
 
 class ScriptFile;
+class CompiledScript;
+class ScriptCache;
+class ArchiveIndex;
+struct Object;
 
 template <class T>
 struct Holder
@@ -86,15 +98,91 @@ public:
 
     virtual Resource GetResource(string Path);
     virtual char* Read(string Path, uint32_t& Size);
-    ScriptFile* GetScriptFile(const string& Path);
-    ScriptFile* ResolveSymbol(const string& Symbol, uint32_t& CodeLine);
+    CompiledScript* GetScript(const string& Path);
+    CompiledScript* ResolveSymbol(const string& Name, uint32_t& CodeLine);
+    // Includes are parsed ahead by the workers, but only added when a function is not found
+    // in the scripts added so far
+    void QueueIncludes(CompiledScript* pScript);
+    uint32_t GetGeneration() { return Generation; }
+
+    // Load the script on a worker, returns an object to wait on or nullptr if GetScript won't block.
+    // Called on the engine thread only: the wait object belongs to the calling thread's engine
+    Object* LoadScript(const string& Path);
+    // Add scripts loaded by the workers and delete their wait objects, called on the engine thread
+    void Poll();
+    // Must be called before a derived class is destroyed
+    void StopLoading();
+    // Parsed scripts are read from and written to this file from now on
+    void OpenScriptCache(const string& Filename);
+    // Files of archives added with AddArchive are looked up in this index, which is rebuilt if stale
+    void OpenArchiveIndex(const string& Filename);
 
 protected:
+    // May be called from worker threads, archives are only read through Read
     virtual ScriptFile* ReadScriptFile(const string& Path) = 0;
-    Holder<ScriptFile> CacheHolder;
+    // The archive is opened by Open the first time a file is looked up in it
+    void AddArchive(const string& Filename, function<INpaFile*(const string&)> Open);
+    Holder<CompiledScript> CacheHolder;
+    // Opened up front and searched before the added archives
     vector<INpaFile*> Archives;
-};
+    // Bumped whenever a script is loaded, invalidates call site caches
+    uint32_t Generation;
+
+private:
+    struct Symbol
+    {
+        CompiledScript* pScript;
+        uint32_t CodeLine;
+    };
+
+    struct LazyArchive
+    {
+        string Filename;
+        function<INpaFile*(const string&)> Open;
+        INpaFile* pArchive;
+    };
 
-extern ResourceMgr* sResourceMgr;
+    struct LoadJob
+    {
+        CompiledScript* pScript;
+        // Deleted when the job is done, which wakes the threads waiting on it
+        Object* pWait;
+        bool Done;
+        // Include parsed ahead, kept out of the cache by Poll until it is needed
+        bool Prefetch;
+    };
+
+    INpaFile* FindArchive(const string& Path, INpaFile::NpaIterator& File);
+    INpaFile* GetArchive(uint32_t Index);
+    CompiledScript* CompileScript(const string& Path);
+    void AddScript(const string& Path, CompiledScript* pScript);
+    void IndexSymbols(CompiledScript* pScript);
+    void QueueLoad(const string& Path, bool Prefetch);
+    void StartWorkers();
+    void WorkerMain();
+
+    // Functions of every loaded script
+    unordered_map<string, Symbol> Symbols;
+    deque<string> PendingIncludes;
+    ScriptCache* pScriptCache;
+
+    vector<LazyArchive> LazyArchives;
+    ArchiveIndex* pArchiveIndex;
+    // Archives may be opened from worker threads
+    mutex ArchiveLock;
+
+    // Everything below LoadLock is shared with the workers
+    mutex LoadLock;
+    condition_variable LoadCond;
+    condition_variable DoneCond;
+    vector<thread> Workers;
+    deque<string> LoadQueue;
+    map<string, LoadJob> Jobs;
+    // Paths which were loaded or queued once, failures are not retried by workers
+    unordered_set<string> Requested;
+    atomic<uint32_t> NumDone;
+    bool Stopping;
+    mutex ReadLock;
+};
 
 #endif
@@ -0,0 +1,77 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include "Object.hpp"
+using namespace std;
+
+class NSBContext;
+
+/*
+ * Keeps script threads in one of three places: the ready queue, the timer
+ * queue (ordered by absolute wake deadline) or parked until a click or an
+ * object wakes them. Only ready threads are visited every round; waiting
+ * ones cost nothing until their deadline passes or the object they wait
+ * on notifies the scheduler. Every queue position is stored in the
+ * context, so any thread can be removed in O(1).
+ * */
+class Scheduler : public ObjectListener
+{
+public:
+    Scheduler();
+    ~Scheduler();
+
+    void Add(NSBContext* pContext);
+    void Remove(NSBContext* pContext);
+    void Suspend(NSBContext* pContext);
+    void Wake(NSBContext* pContext);
+
+    // Pop the next ready thread. It is owned by the caller until Requeue or Suspend
+    NSBContext* Pop();
+    void Requeue(NSBContext* pContext);
+    bool WasRemoved() { return RunningRemoved; }
+
+    void Update(uint32_t Diff);
+    void Poll();
+    void OnClick();
+    void OnAction(Object* pObject);
+    void OnDestroy(Object* pObject);
+
+    size_t GetNumReady() { return Ready.size(); }
+    bool IsEmpty() { return Threads.empty(); }
+    const list<NSBContext*>& GetThreads() { return Threads; }
+
+private:
+    void Unlink(NSBContext* pContext);
+    void WakeWaiters(Object* pObject);
+
+    uint64_t Now;
+    NSBContext* pRunning;
+    bool RunningRemoved;
+    list<NSBContext*> Threads;
+    list<NSBContext*> Ready;
+    multimap<Object*, NSBContext*> Waiters;
+    list<NSBContext*> ClickWaiters;
+    multimap<uint64_t, NSBContext*> Timers;
+};
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef SCRIPT_CACHE_HPP
+#define SCRIPT_CACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+using namespace std;
+
+class CompiledScript;
+struct ScriptImage;
+
+/*
+ * Parsed scripts, kept on disk between runs. An entry stores the decoded
+ * lines, includes and symbol table of one script, keyed by its path and a
+ * hash of its archive data. The file is mapped at startup and only the
+ * table of contents is read; entries are decoded (and checked against the
+ * archive) when a script is loaded. A cache written by another engine
+ * version is ignored, stale entries are replaced as scripts are stored.
+ * Load and Store may be called from loader threads.
+ * */
+class ScriptCache
+{
+    struct Entry
+    {
+        uint64_t Hash;
+        uint64_t Offset;
+        uint64_t Length;
+    };
+public:
+    ScriptCache(const string& Filename);
+    ~ScriptCache();
+
+    // Returns nullptr on a miss, the image is owned by the caller
+    ScriptImage* Load(const string& Path, uint64_t Hash);
+    void Store(const string& Path, uint64_t Hash, CompiledScript* pScript);
+
+    static uint64_t HashData(const char* pData, uint32_t Size);
+
+private:
+    bool Map();
+    bool Save();
+
+    string Filename;
+    const char* pData;
+    size_t Size;
+    // Entries of the mapped file
+    unordered_map<string, Entry> Entries;
+    // Entries stored since, written out on destruction
+    map<string, pair<uint64_t, string>> Stored;
+    mutex Lock;
+};
+
+#endif
@@ -27,6 +27,9 @@ public:
     Scrollbar(Texture* pTexture, int32_t X1, int32_t Y1, int32_t X2, int32_t Y2, int32_t Min, int32_t Max, string Type, string Callback);
     ~Scrollbar();
 
+    static const uint16_t TYPE = OBJECT_SCROLLBAR;
+    static Scrollbar* Cast(Object* pObject) { return static_cast<Scrollbar*>(pObject); }
+
     void SetWheelArea(int32_t X, int32_t Y, int32_t Width, int32_t Height);
     void SetValue(int32_t NewValue);
     int32_t GetValue();
@@ -0,0 +1,64 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef STARTUP_TIMELINE_HPP
+#define STARTUP_TIMELINE_HPP
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+using namespace std;
+
+/*
+ * Time from engine creation to the end of each startup phase, up to the
+ * first frame and the first time a script waits for input (interactive).
+ * Marks after that are ignored, so hot paths may mark cheaply. Phases are
+ * printed as they end when NPENGINE_TIMELINE is set in the environment.
+ * Marks may come from any thread.
+ * */
+class StartupTimeline
+{
+public:
+    struct Phase
+    {
+        string Name;
+        // Milliseconds since the engine was created
+        double Time;
+    };
+
+    StartupTimeline();
+
+    void Mark(const string& Name);
+    // Ends the timeline
+    void MarkInteractive() { if (!Done) Finish(); }
+
+    bool IsDone() { return Done; }
+    vector<Phase> GetPhases();
+
+private:
+    void Finish();
+
+    chrono::steady_clock::time_point Start;
+    bool Print;
+    atomic<bool> Done;
+    mutex Lock;
+    vector<Phase> Phases;
+};
+
+#endif
@@ -28,6 +28,9 @@ public:
     Text();
     ~Text();
 
+    static const uint16_t TYPE = OBJECT_TEXT;
+    static Text* Cast(Object* pObject) { return static_cast<Text*>(pObject->pGLTexture); }
+
     void CreateFromXML(const string& XML);
     void CreateFromString(const string& String);
 
@@ -37,13 +40,8 @@ public:
     bool Advance();
 
     void Request(int32_t State);
+    virtual bool Action();
 
-    static string dFont;
-    static int32_t dSize;
-    static uint32_t dInColor;
-    static uint32_t dOutColor;
-    static int32_t dWeight;
-    static string dAlign;
 private:
     void SetString(const string& String);
 
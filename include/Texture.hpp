@@ -34,9 +34,13 @@ public:
     Texture();
     virtual ~Texture();
 
+    static const uint16_t TYPE = OBJECT_TEXTURE;
+    static Texture* Cast(Object* pObject) { return static_cast<Texture*>(pObject->pGLTexture); }
+
     void CreateFromGLTexture(GLTexture* pTexture);
 
     void Request(int32_t State);
+    virtual bool Action();
     void SetPosition(int X, int Y);
     void SetAngle(int Angle);
     void SetScale(int XScale, int YScale);
@@ -68,6 +72,8 @@ public:
     int32_t RemainFade();
 
 private:
+    bool IsAnimating();
+
     MoveEffect* pMove;
     ZoomEffect* pZoom;
     FadeEffect* pFade;
@@ -1,17 +1,17 @@
-/* 
+/*
  * libnpengine: Nitroplus script interpreter
  * Copyright (C) 2014-2016,2018 Mislav Blažević <krofnica996@gmail.com>
- * 
+ *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU Lesser Public License as published by
  * the Free Software Foundation, either version 3 of the License, or
  * (at your option) any later version.
- * 
+ *
  * This program is distributed in the hope that it will be useful,
  * but WITHOUT ANY WARRANTY; without even the implied warranty of
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  * GNU Lesser Public License for more details.
- * 
+ *
  * You should have received a copy of the GNU Lesser Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * */
@@ -21,43 +21,77 @@
 #include <cstdint>
 #include <string>
 #include <functional>
+#include <vector>
 #include <map>
+#include <atomic>
 using namespace std;
 
-class Variable
+class Variable;
+typedef function<void(Variable*)> VariableHook;
+
+/*
+ * Small tagged value used for interpreter temporaries. Strings are never
+ * owned by the value: they point either into the string table, into a
+ * buffer owned by the parameter stack, or into a Variable.
+ * */
+struct Value
 {
-protected:
     enum
     {
         NSB_NULL = 0,
         NSB_INT = 1,
         NSB_FLOAT = 2,
         NSB_STRING = 3,
-        NSB_BOOL = 4
-    } Tag;
+        NSB_BOOL = 4,
+        NSB_VARIABLE = 5
+    };
+
+    static Value MakeNull();
+    static Value MakeInt(int32_t Int);
+    static Value MakeFloat(float Float);
+    static Value MakeString(const string* pStr, uint32_t Id = NO_ID);
+    static Value MakeVariable(Variable* pVar);
+
+    const Value& Deref() const;
+    Variable* GetVariable() const { return Tag == NSB_VARIABLE ? pVar : nullptr; }
+    const string* GetString() const;
+
+    int GetTag() const;
+    float ToFloat() const;
+    int32_t ToInt() const;
+    string ToString() const;
+    void AppendTo(string& Str) const;
+    bool IsFloat() const;
+    bool IsInt() const;
+    bool IsString() const;
+    bool IsNull() const;
+    bool IsRelative() const;
 
-    struct
+    static bool IsRelative(const string& Str);
+
+    static const uint32_t NO_ID = UINT32_MAX;
+
+    uint8_t Tag;
+    bool Relative;
+    // String table id of a string value, NO_ID if it was built at runtime
+    uint32_t Id;
+    union
     {
         int32_t Int;
         float Float;
-        string Str;
-        bool Bool;
-    } Val;
-
-    Variable();
-
-    void Initialize();
-    void Initialize(Variable* pVar);
+        const string* pStr;
+        Variable* pVar;
+    };
+};
 
+class Variable
+{
+    friend struct Value;
 public:
+    Variable(const string& Name);
+    Variable(const Variable&) = delete;
     virtual ~Variable();
 
-    static Variable* MakeNull(const string& Name);
-    static Variable* MakeFloat(float Float);
-    static Variable* MakeInt(int32_t Int);
-    static Variable* MakeString(const string& Str);
-    static Variable* MakeCopy(Variable* pVar, const string& Name);
-
     int GetTag();
     float ToFloat();
     int32_t ToInt();
@@ -66,19 +100,48 @@ public:
     bool IsInt();
     bool IsString();
     bool IsNull();
-    void Set(Variable* pVar);
+    void Set(const Value& Val);
     void Set(float Float);
     void Set(int32_t Int);
     void Set(const string& Str);
-    Variable* IntUnaryOp(function<int32_t(int32_t)> Func);
 
-    static Variable* Add(Variable* pFirst, Variable* pSecond);
-    static void Destroy(Variable* pVar);
+    // Array storage. Elements are owned by the variable table and named Name/Index
+    Variable* GetElement(int32_t Index);
+    void SetElement(int32_t Index, Variable* pVar);
+    int32_t Count();
+    bool GetKey(const string& Key, int32_t& Index);
+    void SetKey(const string& Key, int32_t Index);
+    void ClearKeys();
+    const map<string, int32_t>& GetKeys();
+
+    // Called after every assignment. Variables without hooks only pay a null check
+    uint32_t AddHook(VariableHook Hook);
+    void RemoveHook(uint32_t Hook);
 
-    bool Literal;
-    bool Relative;
-    map<string, int> Assoc;
     string Name;
+
+private:
+    struct Array
+    {
+        Array() : Size(0) { }
+        // Indices up to MAX_DENSE, the rest are rare and kept by index
+        vector<Variable*> Elements;
+        map<int32_t, Variable*> Sparse;
+        map<string, int32_t> Keys;
+        int32_t Size;
+    };
+
+    static const int32_t MAX_DENSE = 4096;
+
+    Array* GetArray();
+    void Changed() { if (pHooks) RunHooks(); }
+    void RunHooks();
+
+    Value Val;
+    string Str;
+    Array* pArray;
+    map<uint32_t, VariableHook>* pHooks;
+    static atomic<uint32_t> NextHook;
 };
 
 #endif
@@ -0,0 +1,71 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#ifndef VARIABLE_TABLE_HPP
+#define VARIABLE_TABLE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+class Variable;
+
+/*
+ * Variables are stored in slots indexed by the id of their interned name,
+ * so instructions whose operands were interned at load time reach their
+ * variable with a single vector index. The name map is only used for
+ * enumeration (save files, debugger).
+ *
+ * Array elements are ordinary variables named Array/Index, which keeps
+ * the save file layout and name[n] lookups working. They are linked into
+ * their parent's element vector when created, so indexing and counting
+ * does not go through names.
+ * */
+class VariableTable
+{
+public:
+    ~VariableTable();
+
+    Variable* Read(uint32_t Id)
+    {
+        return Id < Slots.size() ? Slots[Id] : nullptr;
+    }
+
+    Variable* Get(uint32_t Id)
+    {
+        if (Variable* pVar = Read(Id))
+            return pVar;
+        return Create(Id);
+    }
+
+    Variable* Read(const string& Name);
+    Variable* Get(const string& Name);
+    Variable* GetElement(Variable* pArray, int32_t Index);
+
+    const map<string, Variable*>& GetNames() { return Names; }
+
+private:
+    Variable* Create(uint32_t Id);
+    void Link(Variable* pVar);
+
+    vector<Variable*> Slots;
+    map<string, Variable*> Names;
+};
+
+#endif
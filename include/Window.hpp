@@ -21,6 +21,8 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
 #include <list>
+#include <vector>
+#include <mutex>
 using namespace std;
 
 class Texture;
@@ -31,7 +33,7 @@ public:
     Window(const char* WindowTitle, const int Width, const int Height);
     virtual ~Window();
 
-    static void PushMoveCursorEvent(int X, int Y);
+    void PushMoveCursorEvent(int X, int Y);
 
     void Run();
     void Exit();
@@ -42,6 +44,7 @@ public:
     bool IsRunning_() { return IsRunning; }
     void SetFullscreen(Uint32 flags);
     void DrawTextures(uint32_t Diff);
+    void SetInterpreterBudget(uint32_t Budget, uint32_t Quota);
 
     const int WIDTH;
     const int HEIGHT;
@@ -51,12 +54,20 @@ protected:
     NSBInterpreter* pInterpreter;
 private:
     void Draw();
+    static void Dispatch(const SDL_Event& Event);
 
     uint32_t LastDrawTime;
+    // Microseconds of script execution per frame, 0 runs a fixed number of rounds
+    uint32_t Budget;
     bool IsRunning;
     bool EventLoop;
+    bool FirstFrame;
     SDL_Window* SDLWindow;
+    uint32_t WindowID;
     SDL_GLContext GLContext;
+    // Events of this window polled by any engine, see Dispatch
+    mutex InboxLock;
+    vector<SDL_Event> Inbox;
     list<Texture*> Textures;
 };
 
@@ -0,0 +1,205 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "ArchiveIndex.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint32_t FORMAT_VERSION = 1;
+static const char MAGIC[4] = { 'N', 'P', 'A', 'I' };
+
+// Path offset, path length, archive, size
+static const uint32_t RECORD_SIZE = 4 * sizeof(uint32_t);
+
+// Host byte order, the index is only read on the machine which wrote it
+template <class T>
+static bool Get(const char*& p, const char* pEnd, T& Value)
+{
+    if (size_t(pEnd - p) < sizeof(T))
+        return false;
+    memcpy(&Value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+template <class T>
+static void Put(string& Out, T Value)
+{
+    Out.append((const char*)&Value, sizeof(T));
+}
+
+ArchiveIndex::ArchiveIndex(const string& Filename, const vector<Stamp>& Archives) :
+pData(nullptr),
+Size(0),
+pRecords(nullptr),
+NumRecords(0)
+{
+    if (!Map(Filename, Archives))
+        pRecords = nullptr;
+}
+
+ArchiveIndex::~ArchiveIndex()
+{
+    if (pData)
+        munmap((void*)pData, Size);
+}
+
+bool ArchiveIndex::Map(const string& Filename, const vector<Stamp>& Archives)
+{
+    int fd = open(Filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat Stat;
+    if (fstat(fd, &Stat) == 0 && Stat.st_size > 0)
+    {
+        void* pMap = mmap(nullptr, Stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pMap != MAP_FAILED)
+        {
+            pData = (const char*)pMap;
+            Size = Stat.st_size;
+        }
+    }
+    close(fd);
+    if (!pData)
+        return false;
+
+    const char* p = pData;
+    const char* pEnd = pData + Size;
+    uint32_t Version, NumArchives;
+    if (Size < sizeof(MAGIC) || memcmp(p, MAGIC, sizeof(MAGIC)))
+        return false;
+    p += sizeof(MAGIC);
+    if (!Get(p, pEnd, Version) || Version != FORMAT_VERSION ||
+        !Get(p, pEnd, NumArchives) || NumArchives != Archives.size())
+        return false;
+
+    for (const Stamp& Archive : Archives)
+    {
+        uint32_t Length;
+        uint64_t ArchiveSize;
+        int64_t MTime;
+        if (!Get(p, pEnd, Length) || size_t(pEnd - p) < Length ||
+            Archive.Filename.compare(0, string::npos, p, Length))
+            return false;
+        p += Length;
+        if (!Get(p, pEnd, ArchiveSize) || ArchiveSize != Archive.Size ||
+            !Get(p, pEnd, MTime) || MTime != Archive.MTime)
+            return false;
+    }
+
+    if (!Get(p, pEnd, NumRecords) || size_t(pEnd - p) / RECORD_SIZE < NumRecords)
+        return false;
+    pRecords = p;
+    return true;
+}
+
+bool ArchiveIndex::Find(const string& Path, Entry& Result)
+{
+    uint32_t Low = 0, High = NumRecords;
+    while (Low < High)
+    {
+        uint32_t Middle = Low + (High - Low) / 2;
+        const char* pRecord = pRecords + Middle * RECORD_SIZE;
+        const char* pEnd = pRecord + RECORD_SIZE;
+        uint32_t PathOffset, PathLength;
+        Get(pRecord, pEnd, PathOffset);
+        Get(pRecord, pEnd, PathLength);
+        // A corrupted index finds nothing rather than reading out of bounds
+        if (PathOffset > Size || PathLength > Size - PathOffset)
+            return false;
+
+        int Compare = Path.compare(0, string::npos, pData + PathOffset, PathLength);
+        if (Compare == 0)
+        {
+            Get(pRecord, pEnd, Result.Archive);
+            Get(pRecord, pEnd, Result.Size);
+            return true;
+        }
+        if (Compare < 0)
+            High = Middle;
+        else
+            Low = Middle + 1;
+    }
+    return false;
+}
+
+bool ArchiveIndex::GetStamp(const string& Filename, Stamp& Result)
+{
+    struct stat Stat;
+    if (stat(Filename.c_str(), &Stat) != 0)
+        return false;
+
+    Result.Filename = Filename;
+    Result.Size = Stat.st_size;
+    // Nanoseconds, an archive replaced within a second is still noticed
+    Result.MTime = int64_t(Stat.st_mtim.tv_sec) * 1000000000 + Stat.st_mtim.tv_nsec;
+    return true;
+}
+
+// Written to a temporary file first, so a crash never leaves half an index
+bool ArchiveIndex::Write(const string& Filename, const vector<Stamp>& Archives, const map<string, Entry>& Entries)
+{
+    string Header, Records, Paths;
+    Header.append(MAGIC, sizeof(MAGIC));
+    Put<uint32_t>(Header, FORMAT_VERSION);
+    Put<uint32_t>(Header, Archives.size());
+    for (const Stamp& Archive : Archives)
+    {
+        Put<uint32_t>(Header, Archive.Filename.size());
+        Header += Archive.Filename;
+        Put<uint64_t>(Header, Archive.Size);
+        Put<int64_t>(Header, Archive.MTime);
+    }
+    Put<uint32_t>(Header, Entries.size());
+
+    // Map order is the byte order Find searches in
+    size_t PathsBegin = Header.size() + Entries.size() * RECORD_SIZE;
+    for (auto& i : Entries)
+    {
+        Put<uint32_t>(Records, PathsBegin + Paths.size());
+        Put<uint32_t>(Records, i.first.size());
+        Put<uint32_t>(Records, i.second.Archive);
+        Put<uint32_t>(Records, i.second.Size);
+        Paths += i.first;
+    }
+
+    // Unique, engines in one process may write the same index at once
+    string TempFilename = Filename + ".XXXXXX";
+    int fd = mkstemp(&TempFilename[0]);
+    if (fd == -1)
+        return false;
+    close(fd);
+
+    ofstream File(TempFilename, ios::binary | ios::trunc);
+    File.write(Header.data(), Header.size());
+    File.write(Records.data(), Records.size());
+    File.write(Paths.data(), Paths.size());
+    File.close();
+
+    if (!File)
+    {
+        remove(TempFilename.c_str());
+        return false;
+    }
+    return rename(TempFilename.c_str(), Filename.c_str()) == 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "CompiledScript.hpp"
+#include "scriptfile.hpp"
+#include "nsbmagic.hpp"
+#include "nsbconstants.hpp"
+
+StringTable sStringTable;
+bool CompiledScript::EnableFusion = true;
+atomic<uint32_t> CompiledScript::FusedSites[NUM_FUSED];
+bool CompiledScript::EnableExpressions = true;
+atomic<uint32_t> CompiledScript::ExpressionSites;
+
+ScriptImage::~ScriptImage()
+{
+    for (Line* pLine : Lines)
+        delete pLine;
+}
+
+CompiledScript::CompiledScript(ScriptFile* pScript) : pScript(pScript), pImage(nullptr)
+{
+    Compile();
+}
+
+CompiledScript::CompiledScript(ScriptImage* pImage) : pScript(nullptr), pImage(pImage)
+{
+    Compile();
+}
+
+CompiledScript::~CompiledScript()
+{
+    delete pScript;
+    delete pImage;
+}
+
+void CompiledScript::Compile()
+{
+    // Line numbers start at 1 if there is no line 0, keep them as indices
+    uint32_t i = 0;
+    if (!GetSourceLine(i))
+        Code.push_back({0, 0, 0, Instruction::OPERAND_NONE, {0}, 0, 0, nullptr, 0});
+
+    for (i = Code.size(); Line* pLine = GetSourceLine(i); ++i)
+    {
+        Code.emplace_back();
+        Decode(Code.back(), pLine);
+    }
+    Link();
+    if (EnableFusion)
+        Fuse();
+    if (EnableExpressions)
+        FindExpressions();
+}
+
+Line* CompiledScript::GetSourceLine(uint32_t LineNumber)
+{
+    if (pScript)
+        return pScript->GetLine(LineNumber);
+    return LineNumber < pImage->Lines.size() ? pImage->Lines[LineNumber] : nullptr;
+}
+
+void CompiledScript::Decode(Instruction& Instr, Line* pLine)
+{
+    Instr.Magic = pLine->Magic;
+    Instr.Handler = Instr.Magic;
+    Instr.NumParams = pLine->Params.size();
+    Instr.Type = Instruction::OPERAND_NONE;
+    Instr.Int = 0;
+    Instr.Str = Instr.NumParams ? sStringTable.Intern(pLine->Params[0]) : 0;
+    Instr.Operands = ParamIds.size();
+    Instr.pLine = pLine;
+    Instr.Expr = 0;
+    for (const string& Param : pLine->Params)
+        ParamIds.push_back(sStringTable.Intern(Param));
+
+    switch (Instr.Magic)
+    {
+        case MAGIC_CALL_FUNCTION:
+        case MAGIC_CALL_SCENE:
+        case MAGIC_CALL_CHAPTER:
+            Instr.Site = CallSites.size();
+            CallSites.push_back({nullptr, NSB_INVALIDE_LINE, 0});
+            return;
+        case MAGIC_LITERAL:
+            break;
+        default:
+            return;
+    }
+
+    if (Instr.NumParams < 2)
+        return;
+
+    const string& Type = pLine->Params[0];
+    const string& Val = pLine->Params[1];
+    try
+    {
+        if (Type == "INT")
+        {
+            Instr.Int = stoi(Val);
+            Instr.Type = Instruction::OPERAND_INT;
+        }
+        else if (Type == "FLOAT")
+        {
+            Instr.Float = stof(Val);
+            Instr.Type = Instruction::OPERAND_FLOAT;
+        }
+        else if (Type == "STRING")
+        {
+            Instr.Str = sStringTable.Intern(Val);
+            Instr.Type = Instruction::OPERAND_STRING;
+        }
+    }
+    catch (...)
+    {
+        Instr.Str = sStringTable.Intern(Val);
+        Instr.Type = Instruction::OPERAND_STRING;
+    }
+}
+
+void CompiledScript::Link()
+{
+    Targets.assign(ParamIds.size(), NSB_INVALIDE_LINE);
+    for (Instruction& Instr : Code)
+    {
+        switch (Instr.Magic)
+        {
+            case MAGIC_IF:
+            case MAGIC_WHILE:
+            case MAGIC_JUMP:
+            case MAGIC_SELECT:
+            case MAGIC_CASE:
+                for (uint32_t i = 0; i < Instr.NumParams; ++i)
+                    Targets[Instr.Operands + i] = GetSymbol(Instr.pLine->Params[i]);
+                break;
+        }
+    }
+}
+
+/*
+ * Peephole pass over common sequences. Only the first instruction of a
+ * sequence is retargeted, the rest stay in place so jumps into the middle
+ * of a sequence (and the debugger) still see the original code.
+ * */
+void CompiledScript::Fuse()
+{
+    for (uint32_t i = 0; i < Code.size(); ++i)
+    {
+        if (uint16_t Handler = Match(i))
+        {
+            Code[i].Handler = Handler;
+            FusedSites[Handler - MAGIC_FUSED_BEGIN]++;
+        }
+    }
+}
+
+uint16_t CompiledScript::Match(uint32_t Index)
+{
+    static const uint32_t ArrayVariableId = sStringTable.Intern("__array_variable__");
+    static const uint32_t SendMailId = sStringTable.Intern("$SW_PHONE_SENDMAILNO");
+
+    Instruction* pInstr = &Code[Index];
+    uint32_t Left = Code.size() - Index;
+    auto IsNumber = [] (Instruction& Instr)
+    {
+        return Instr.Magic == MAGIC_LITERAL &&
+            (Instr.Type == Instruction::OPERAND_INT || Instr.Type == Instruction::OPERAND_FLOAT);
+    };
+    auto IsAssign = [] (Instruction& Instr)
+    {
+        return Instr.Magic == MAGIC_ASSIGN && Instr.NumParams && Instr.Str != ArrayVariableId;
+    };
+
+    // $var = number;
+    if (Left >= 2 && IsNumber(pInstr[0]) && IsAssign(pInstr[1]))
+        return MAGIC_FUSED_ASSIGN_LITERAL;
+
+    if (pInstr[0].Magic != MAGIC_VARIABLE || !pInstr[0].NumParams)
+        return 0;
+
+    // $var++; $var--;
+    if (Left >= 2 && pInstr[0].Str != SendMailId &&
+       (pInstr[1].Magic == MAGIC_INCREMENT || pInstr[1].Magic == MAGIC_DECREMENT))
+        return MAGIC_FUSED_INCREMENT;
+
+    if (Left < 4 || pInstr[1].Magic != MAGIC_LITERAL || pInstr[1].Type != Instruction::OPERAND_INT)
+        return 0;
+
+    // if ($var <op> int)
+    switch (pInstr[2].Magic)
+    {
+        case MAGIC_CMP_EQUAL:
+        case MAGIC_LOGICAL_NOT_EQUAL:
+        case MAGIC_CMP_GREATER:
+        case MAGIC_CMP_LESS:
+        case MAGIC_LOGICAL_GREATER_EQUAL:
+        case MAGIC_LOGICAL_LESS_EQUAL:
+            if (pInstr[3].Magic == MAGIC_IF)
+                return MAGIC_FUSED_COMPARE_BRANCH;
+            break;
+        // $dst = $var +- int;
+        case MAGIC_ADD_EXPRESSION:
+        case MAGIC_SUB_EXPRESSION:
+            if (IsAssign(pInstr[3]))
+                return MAGIC_FUSED_ARITH_ASSIGN;
+            break;
+    }
+    return 0;
+}
+
+/*
+ * Statements which the expression compiler can handle start counting
+ * their executions. Superinstructions already cover the short ones, so
+ * only statements whose first line was not fused are considered.
+ * */
+void CompiledScript::FindExpressions()
+{
+    for (uint32_t i = 1; i < Code.size(); ++i)
+    {
+        Instruction& Instr = Code[i];
+        if (Instr.Handler != Instr.Magic || Code[i - 1].Magic != MAGIC_CLEAR_PARAMS)
+            continue;
+
+        if (uint32_t Length = Expression::Scan(&Instr, Code.size() - i))
+        {
+            Instr.Handler = MAGIC_PROFILE_EXPRESSION;
+            Instr.Expr = Expressions.size();
+            Expressions.emplace_back(Length);
+            ExpressionSites++;
+            i += Length - 1;
+        }
+    }
+}
+
+const string& CompiledScript::GetName()
+{
+    return pScript ? pScript->GetName() : pImage->Name;
+}
+
+uint32_t CompiledScript::GetSymbol(const string& Symbol)
+{
+    if (pScript)
+        return pScript->GetSymbol(Symbol);
+
+    auto iter = pImage->Symbols.find(Symbol);
+    return iter != pImage->Symbols.end() ? iter->second : NSB_INVALIDE_LINE;
+}
+
+const vector<string>& CompiledScript::GetIncludes()
+{
+    return pScript ? pScript->GetIncludes() : pImage->Includes;
+}
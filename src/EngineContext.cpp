@@ -0,0 +1,59 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "EngineContext.hpp"
+#include "ResourceMgr.hpp"
+#include "Playable.hpp"
+
+thread_local EngineContext* sEngine;
+
+EngineContext::EngineContext(ResourceMgr* pResourceMgr) :
+pResourceMgr(pResourceMgr),
+pWindow(nullptr),
+DefaultText({"", 0, 0, 0, 0, ""}),
+pVoice(nullptr)
+{
+    MakeCurrent();
+    GStreamerInit = thread([this]
+    {
+        Playable::InitGStreamer();
+        Timeline.Mark("gstreamer");
+    });
+}
+
+EngineContext::~EngineContext()
+{
+    GStreamerInit.join();
+    delete pVoice;
+    if (pResourceMgr)
+        pResourceMgr->StopLoading();
+    delete pResourceMgr;
+    if (sEngine == this)
+        sEngine = nullptr;
+}
+
+void EngineContext::MakeCurrent()
+{
+    sEngine = this;
+}
+
+void EngineContext::PlayVoice(const string& Filename)
+{
+    delete pVoice;
+    pVoice = new Playable(pResourceMgr->GetResource(Filename + ".ogg"));
+    pVoice->Play();
+}
@@ -0,0 +1,163 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "Expression.hpp"
+#include "CompiledScript.hpp"
+#include "VariableTable.hpp"
+#include "Variable.hpp"
+
+uint32_t Expression::Threshold = 16;
+
+Expression::Expression(uint32_t Length) : Count(0), Length(Length)
+{
+}
+
+uint32_t Expression::Scan(Instruction* pInstr, uint32_t Left)
+{
+    static const uint32_t ArrayVariableId = sStringTable.Intern("__array_variable__");
+
+    uint32_t Depth = 0;
+    uint32_t NumOperators = 0;
+    for (uint32_t i = 0; i < Left; ++i)
+    {
+        Instruction& Instr = pInstr[i];
+        switch (Instr.Magic)
+        {
+            case MAGIC_LITERAL:
+                if (Instr.Type != Instruction::OPERAND_INT)
+                    return 0;
+                Depth++;
+                break;
+            case MAGIC_VARIABLE:
+                if (!Instr.NumParams)
+                    return 0;
+                Depth++;
+                break;
+            case MAGIC_ADD_EXPRESSION:
+            case MAGIC_SUB_EXPRESSION:
+            case MAGIC_MUL_EXPRESSION:
+            case MAGIC_DIV_EXPRESSION:
+            case MAGIC_MOD_EXPRESSION:
+            case MAGIC_CMP_EQUAL:
+            case MAGIC_LOGICAL_NOT_EQUAL:
+            case MAGIC_CMP_GREATER:
+            case MAGIC_CMP_LESS:
+            case MAGIC_LOGICAL_GREATER_EQUAL:
+            case MAGIC_LOGICAL_LESS_EQUAL:
+            case MAGIC_CMP_LOGICAL_AND:
+            case MAGIC_CMP_LOGICAL_OR:
+                if (Depth < 2)
+                    return 0;
+                Depth--;
+                NumOperators++;
+                break;
+            case MAGIC_LOGICAL_NOT:
+                if (Depth < 1)
+                    return 0;
+                NumOperators++;
+                break;
+            case MAGIC_ASSIGN:
+                if (!Instr.NumParams || Instr.Str == ArrayVariableId)
+                    return 0;
+                // Fall through
+            case MAGIC_IF:
+            case MAGIC_WHILE:
+                // Plain copies are not worth compiling
+                return Depth == 1 && NumOperators ? i + 1 : 0;
+            default:
+                return 0;
+        }
+        if (Depth > MAX_DEPTH)
+            return 0;
+    }
+    return 0;
+}
+
+void Expression::Compile(Instruction* pInstr)
+{
+    uint8_t Depth = 0;
+    for (uint32_t i = 0; i < Length - 1; ++i)
+    {
+        Instruction& Instr = pInstr[i];
+        switch (Instr.Magic)
+        {
+            case MAGIC_LITERAL:
+                Nodes.push_back({Instr.Magic, Depth++, Instr.Int});
+                break;
+            case MAGIC_VARIABLE:
+                Nodes.push_back({Instr.Magic, Depth++, static_cast<int32_t>(Instr.Str)});
+                break;
+            case MAGIC_LOGICAL_NOT:
+                Nodes.push_back({Instr.Magic, static_cast<uint8_t>(Depth - 1), 0});
+                break;
+            default:
+                // Top of the stack is the right operand, result replaces both
+                Depth--;
+                Nodes.push_back({Instr.Magic, static_cast<uint8_t>(Depth - 1), 0});
+                break;
+        }
+    }
+}
+
+bool Expression::Evaluate(VariableTable& Variables, int32_t& Result)
+{
+    int32_t Registers[MAX_DEPTH + 1];
+    for (const Node& N : Nodes)
+    {
+        // Dest holds the left operand of binary operators
+        int32_t& Dest = Registers[N.Dest];
+        int32_t& Rhs = Registers[N.Dest + 1];
+        switch (N.Magic)
+        {
+            case MAGIC_LITERAL:
+                Dest = N.Operand;
+                break;
+            case MAGIC_VARIABLE:
+            {
+                Variable* pVar = Variables.Get(N.Operand);
+                if (!pVar->IsInt())
+                    return false;
+                Dest = pVar->ToInt();
+                break;
+            }
+            case MAGIC_LOGICAL_NOT: Dest = !Dest; break;
+            case MAGIC_ADD_EXPRESSION: Dest = Dest + Rhs; break;
+            case MAGIC_SUB_EXPRESSION: Dest = Dest - Rhs; break;
+            case MAGIC_MUL_EXPRESSION: Dest = Dest * Rhs; break;
+            case MAGIC_DIV_EXPRESSION:
+                if (!Rhs)
+                    return false;
+                Dest = Dest / Rhs;
+                break;
+            case MAGIC_MOD_EXPRESSION:
+                if (!Rhs)
+                    return false;
+                Dest = Dest % Rhs;
+                break;
+            case MAGIC_CMP_EQUAL: Dest = Dest == Rhs; break;
+            case MAGIC_LOGICAL_NOT_EQUAL: Dest = Dest != Rhs; break;
+            case MAGIC_CMP_GREATER: Dest = Dest > Rhs; break;
+            case MAGIC_CMP_LESS: Dest = Dest < Rhs; break;
+            case MAGIC_LOGICAL_GREATER_EQUAL: Dest = Dest >= Rhs; break;
+            case MAGIC_LOGICAL_LESS_EQUAL: Dest = Dest <= Rhs; break;
+            case MAGIC_CMP_LOGICAL_AND: Dest = Dest && Rhs; break;
+            case MAGIC_CMP_LOGICAL_OR: Dest = Dest || Rhs; break;
+        }
+    }
+    Result = Registers[0];
+    return true;
+}
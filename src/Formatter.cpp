@@ -0,0 +1,187 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "Formatter.hpp"
+#include "Variable.hpp"
+#include <cstdio>
+#include <cstring>
+
+thread_local vector<unique_ptr<Formatter>> Formatter::Cache;
+
+// Longer fields are left to boost::format
+static const int32_t MAX_FIELD = 32;
+
+Formatter::Formatter(const string& Format)
+{
+    Valid = Parse(Format);
+}
+
+Formatter* Formatter::Get(const Value& Format)
+{
+    const Value& Val = Format.Deref();
+    if (Val.Tag != Value::NSB_STRING || Val.Id == Value::NO_ID)
+        return nullptr;
+
+    if (Val.Id >= Cache.size())
+        Cache.resize(Val.Id + 1);
+
+    unique_ptr<Formatter>& pFormatter = Cache[Val.Id];
+    if (!pFormatter)
+        pFormatter.reset(new Formatter(*Val.pStr));
+    return pFormatter->IsValid() ? pFormatter.get() : nullptr;
+}
+
+bool Formatter::Parse(const string& Format)
+{
+    uint32_t NextArg = 0;
+    string Literal;
+    size_t i = 0;
+    auto ReadNumber = [&] ()
+    {
+        int32_t Num = 0;
+        while (i < Format.size() && isdigit(Format[i]) && Num <= MAX_FIELD)
+            Num = Num * 10 + (Format[i++] - '0');
+        return Num;
+    };
+
+    while (i < Format.size())
+    {
+        if (Format[i] != '%')
+        {
+            Literal += Format[i++];
+            continue;
+        }
+        if (++i == Format.size())
+            return false;
+        if (Format[i] == '%')
+        {
+            Literal += Format[i++];
+            continue;
+        }
+
+        if (!Literal.empty())
+        {
+            Ops.push_back({NO_ARG, Literal, 0, 0, -1, false});
+            Literal.clear();
+        }
+
+        Op Placeholder = {NextArg, "%", 's', 0, -1, false};
+        size_t Start = i;
+        if (int32_t Pos = ReadNumber())
+        {
+            // %N% and %N$...
+            if (i < Format.size() && Format[i] == '%')
+            {
+                Placeholder.Arg = Pos - 1;
+                Ops.push_back(Placeholder);
+                ++i;
+                continue;
+            }
+            if (i < Format.size() && Format[i] == '$')
+            {
+                Placeholder.Arg = Pos - 1;
+                ++i;
+            }
+            else
+                i = Start;
+        }
+        if (Placeholder.Arg == NextArg)
+            NextArg++;
+
+        while (i < Format.size() && strchr("-+ 0#", Format[i]) && Placeholder.Text.size() < 6)
+        {
+            Placeholder.Left |= Format[i] == '-';
+            Placeholder.Text += Format[i++];
+        }
+        Placeholder.Width = ReadNumber();
+        if (i < Format.size() && Format[i] == '.')
+        {
+            ++i;
+            Placeholder.Precision = ReadNumber();
+        }
+        while (i < Format.size() && strchr("hlLqjzt", Format[i]))
+            ++i;
+        if (i == Format.size() || !strchr("diusxXofFeEgG", Format[i]))
+            return false;
+        if (Placeholder.Width > MAX_FIELD || Placeholder.Precision > MAX_FIELD)
+            return false;
+
+        Placeholder.Conversion = Format[i++];
+        if (Placeholder.Width)
+            Placeholder.Text += to_string(Placeholder.Width);
+        Ops.push_back(Placeholder);
+    }
+
+    if (!Literal.empty())
+        Ops.push_back({NO_ARG, Literal, 0, 0, -1, false});
+    return true;
+}
+
+void Formatter::Format(const vector<Value>& Args, string& Out)
+{
+    for (const Op& Operation : Ops)
+    {
+        if (Operation.Arg == NO_ARG)
+            Out += Operation.Text;
+        else if (Operation.Arg >= Args.size())
+            continue;
+        else if (Args[Operation.Arg].IsInt() || Args[Operation.Arg].IsFloat())
+            AppendNumber(Operation, Args[Operation.Arg], Out);
+        else if (const string* pStr = Args[Operation.Arg].GetString())
+            AppendString(Operation, *pStr, Out);
+    }
+}
+
+/*
+ * The argument type decides how it is printed, the conversion only picks
+ * the base for integers and the notation for floats, like boost::format.
+ * */
+void Formatter::AppendNumber(const Op& Placeholder, const Value& Val, string& Out)
+{
+    char Spec[16], Buffer[128];
+    string Flags = Placeholder.Text;
+    if (Val.IsInt())
+    {
+        char Conversion = strchr("xXo", Placeholder.Conversion) ? Placeholder.Conversion : 'd';
+        snprintf(Spec, sizeof(Spec), "%s%c", Flags.c_str(), Conversion);
+        snprintf(Buffer, sizeof(Buffer), Spec, Val.ToInt());
+    }
+    else
+    {
+        char Conversion = strchr("fFeEgG", Placeholder.Conversion) ? Placeholder.Conversion : 'g';
+        if (Placeholder.Precision >= 0)
+            Flags += '.' + to_string(Placeholder.Precision);
+        snprintf(Spec, sizeof(Spec), "%s%c", Flags.c_str(), Conversion);
+        snprintf(Buffer, sizeof(Buffer), Spec, Val.ToFloat());
+    }
+    Out += Buffer;
+}
+
+// Precision truncates strings, only '-' of the flags applies
+void Formatter::AppendString(const Op& Placeholder, const string& Str, string& Out)
+{
+    size_t Size = Str.size();
+    if (Placeholder.Precision >= 0 && size_t(Placeholder.Precision) < Size)
+        Size = Placeholder.Precision;
+
+    size_t Padding = size_t(Placeholder.Width) > Size ? Placeholder.Width - Size : 0;
+    if (!Placeholder.Left)
+        Out.append(Padding, ' ');
+    Out.append(Str, 0, Size);
+    if (Placeholder.Left)
+        Out.append(Padding, ' ');
+}
@@ -39,6 +39,8 @@ GLTexture::GLTexture() :
 Width(0), Height(0),
 GLTextureID(GL_INVALID_VALUE)
 {
+    Types |= TYPE;
+    pGLTexture = this;
 }
 
 GLTexture::~GLTexture()
@@ -18,6 +18,7 @@
 #include <GL/glew.h>
 #include "Image.hpp"
 #include "ResourceMgr.hpp"
+#include "EngineContext.hpp"
 #include "Window.hpp"
 #include <jpeglib.h>
 #include <png.h>
@@ -25,6 +26,7 @@
 
 Image::Image() : Format(-1), Width(0), Height(0), pPixels(0)
 {
+    Types |= TYPE;
 }
 
 Image::~Image()
@@ -45,7 +47,7 @@ void Image::LoadColor(int Width, int Height, uint32_t Color)
 void Image::LoadImage(const string& Filename, bool Mask)
 {
     uint32_t Size;
-    uint8_t* pData = (uint8_t*)sResourceMgr->Read(Filename, Size);
+    uint8_t* pData = (uint8_t*)sEngine->pResourceMgr->Read(Filename, Size);
     if (!pData)
         return;
 
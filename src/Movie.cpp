@@ -22,6 +22,7 @@ Movie::Movie(const string& FileName, Window* pWindow, int32_t Priority, bool Alp
 Playable(FileName),
 Alpha(Alpha)
 {
+    Types |= TYPE;
     SetPriority(Priority);
     InitVideo(pWindow);
     if (Audio)
@@ -17,34 +17,45 @@
  * */
 #include "NSBContext.hpp"
 #include "Text.hpp"
+#include "CompiledScript.hpp"
 #include "scriptfile.hpp"
 #include "nsbconstants.hpp"
 
-NSBContext::NSBContext(const string& Name) : pText(nullptr), pObject(nullptr), Name(Name), WaitTime(0), Elapsed(0), WaitInterrupt(false), Active(false)
+NSBContext::NSBContext(const string& Name) : TextHandle(ObjectTable::INVALID_HANDLE), ObjectHandle(ObjectTable::INVALID_HANDLE), Name(Name), WaitTime(0), WaitInterrupt(false), Active(false)
 {
+    Types |= TYPE;
 }
 
 NSBContext::~NSBContext()
 {
 }
 
-bool NSBContext::Call(ScriptFile* pScript, const string& Symbol)
+bool NSBContext::Call(CompiledScript* pScript, const string& Symbol)
 {
     uint32_t CodeLine = pScript->GetSymbol(Symbol);
     if (CodeLine == NSB_INVALIDE_LINE && Symbol.substr(0, 8) == "function")
-        if (!(pScript = sResourceMgr->ResolveSymbol(Symbol, CodeLine)))
+        if (!(pScript = sEngine->pResourceMgr->ResolveSymbol(Symbol, CodeLine)))
             return false;
-    CallStack.push({pScript, CodeLine - 1});
+    Call(pScript, CodeLine);
     return true;
 }
 
-void NSBContext::Jump(const string& Symbol)
+void NSBContext::Call(CompiledScript* pScript, uint32_t CodeLine)
+{
+    CallStack.push({pScript, CodeLine - 1});
+}
+
+void NSBContext::Jump(uint32_t CodeLine)
 {
-    uint32_t CodeLine = GetScript()->GetSymbol(Symbol);
     if (CodeLine != NSB_INVALIDE_LINE)
         GetFrame()->SourceLine = CodeLine - 1;
 }
 
+void NSBContext::JumpParam(uint32_t Index)
+{
+    Jump(GetScript()->GetTarget(GetInstruction(), Index));
+}
+
 void NSBContext::Break()
 {
     Jump(BreakStack.top());
@@ -55,14 +66,19 @@ const string& NSBContext::GetScriptName()
     return GetScript()->GetName();
 }
 
-ScriptFile* NSBContext::GetScript()
+CompiledScript* NSBContext::GetScript()
 {
     return GetFrame()->pScript;
 }
 
+Instruction* NSBContext::GetInstruction()
+{
+    return GetScript()->GetInstruction(GetLineNumber());
+}
+
 Line* NSBContext::GetLine()
 {
-    return GetScript()->GetLine(GetLineNumber());
+    return GetInstruction()->pLine;
 }
 
 const string& NSBContext::GetParam(uint32_t Index)
@@ -70,9 +86,14 @@ const string& NSBContext::GetParam(uint32_t Index)
     return GetLine()->Params[Index];
 }
 
+uint32_t NSBContext::GetParamId(uint32_t Index)
+{
+    return GetScript()->GetParamId(GetInstruction(), Index);
+}
+
 int NSBContext::GetNumParams()
 {
-    return GetLine()->Params.size();
+    return GetInstruction()->NumParams;
 }
 
 uint32_t NSBContext::GetLineNumber()
@@ -80,9 +101,14 @@ uint32_t NSBContext::GetLineNumber()
     return GetFrame()->SourceLine;
 }
 
+size_t NSBContext::GetCallDepth()
+{
+    return CallStack.size();
+}
+
 uint32_t NSBContext::GetMagic()
 {
-    return GetLine()->Magic;
+    return GetInstruction()->Magic;
 }
 
 NSBContext::StackFrame* NSBContext::GetFrame()
@@ -90,10 +116,10 @@ NSBContext::StackFrame* NSBContext::GetFrame()
     return &CallStack.top();
 }
 
-uint32_t NSBContext::Advance()
+Instruction* NSBContext::Advance()
 {
     GetFrame()->SourceLine++;
-    return GetMagic();
+    return GetInstruction();
 }
 
 void NSBContext::Rewind()
@@ -108,7 +134,7 @@ void NSBContext::Return()
 
 void NSBContext::PushBreak()
 {
-    BreakStack.push(GetParam(0));
+    BreakStack.push(GetScript()->GetTarget(GetInstruction(), 0));
 }
 
 void NSBContext::PopBreak()
@@ -118,13 +144,13 @@ void NSBContext::PopBreak()
 
 void NSBContext::WaitText(Text* pText, int32_t Time)
 {
-    this->pText = pText;
+    TextHandle = pText->GetHandle();
     Wait(Time);
 }
 
 void NSBContext::WaitAction(Object* pObject, int32_t Time)
 {
-    this->pObject = pObject;
+    ObjectHandle = pObject->GetHandle();
     Wait(Time);
 }
 
@@ -137,26 +163,24 @@ void NSBContext::Wait(int32_t Time, bool Interrupt)
 {
     WaitInterrupt = Interrupt;
     WaitTime = Time;
-    Elapsed = 0;
 }
 
 void NSBContext::Wake()
 {
-    pObject = nullptr;
-    pText = nullptr;
+    ObjectHandle = ObjectTable::INVALID_HANDLE;
+    TextHandle = ObjectTable::INVALID_HANDLE;
     WaitInterrupt = false;
     WaitTime = 0;
 }
 
-void NSBContext::TryWake()
-{
-    if (pObject && pObject->Action())
-        Wake();
-}
-
 void NSBContext::OnClick()
 {
-    if (WaitInterrupt || (pText && !pText->Advance()))
+    if (!WaitInterrupt && !TextHandle)
+        return;
+
+    // Text deleted during the wait doesn't block the thread forever
+    Text* pText = GetWaitText();
+    if (WaitInterrupt || !pText || !pText->Advance())
         Wake();
 }
 
@@ -167,7 +191,17 @@ bool NSBContext::IsStarving()
 
 bool NSBContext::IsSleeping()
 {
-    return pText || Elapsed < WaitTime;
+    return TextHandle || WaitTime;
+}
+
+Text* NSBContext::GetWaitText()
+{
+    return Object::FromHandle<Text>(TextHandle);
+}
+
+Object* NSBContext::GetWaitObject()
+{
+    return sEngine->Objects.Get(ObjectHandle);
 }
 
 bool NSBContext::IsActive()
@@ -211,8 +245,3 @@ void NSBContext::WriteTrace(ostream& Stream)
         Returns.pop();
     }
 }
-
-void NSBContext::Update(uint32_t Diff)
-{
-    Elapsed += Diff;
-}
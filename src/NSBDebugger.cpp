@@ -18,6 +18,7 @@
 #include "NSBInterpreter.hpp"
 #include "NSBContext.hpp"
 #include "Window.hpp"
+#include "CompiledScript.hpp"
 #include "nsbmagic.hpp"
 #include "scriptfile.hpp"
 #include <boost/algorithm/string.hpp>
@@ -31,15 +32,35 @@ void NSBInterpreter::StartDebugger()
 
 void NSBInterpreter::SetBreakpoint(const string& Script, int32_t LineNumber)
 {
-    if (ScriptFile* pScript = sResourceMgr->GetScriptFile(Script))
+    if (CompiledScript* pScript = pEngine->pResourceMgr->GetScript(Script))
     {
-        if (pScript->GetLine(LineNumber))
+        if (pScript->GetInstruction(LineNumber))
             Breakpoints.push_back(make_pair(Script, LineNumber));
     }
     else
         cout << "Cannot set breakpoint " << Script << ":" << LineNumber << endl;
 }
 
+void NSBInterpreter::SetWatchpoint(const string& Name)
+{
+    if (Watchpoints.find(Name) != Watchpoints.end())
+        return;
+
+    Watchpoints[Name] = Watch(Name, [this] (Variable* pVar)
+    {
+        cout << "Watchpoint: ";
+        PrintVariable(pVar);
+        DbgBreak(true);
+    });
+}
+
+void NSBInterpreter::ClearWatchpoints()
+{
+    for (auto& i : Watchpoints)
+        Unwatch(i.first, i.second);
+    Watchpoints.clear();
+}
+
 void NSBInterpreter::PrintVariable(Variable* pVar)
 {
     cout << pVar->Name << " = ";
@@ -49,6 +70,35 @@ void NSBInterpreter::PrintVariable(Variable* pVar)
         cout << pVar->ToString() << endl;
 }
 
+void NSBInterpreter::PrintFusionStats()
+{
+    static const char* Names[NUM_FUSED] =
+    {
+        "compare+branch",
+        "assign literal",
+        "arith+assign",
+        "increment"
+    };
+
+    if (!CompiledScript::EnableFusion)
+        cout << "Fusion is disabled" << endl;
+
+    for (uint16_t i = 0; i < NUM_FUSED; ++i)
+        cout << Names[i] << ": " << CompiledScript::FusedSites[i] << " sites, "
+             << FusionHits[i] << " hits, " << FusionMisses[i] << " fallbacks" << endl;
+}
+
+void NSBInterpreter::PrintExpressionStats()
+{
+    ExpressionStats Stats = GetExpressionStats();
+    if (!CompiledScript::EnableExpressions)
+        cout << "Expression compiler is disabled" << endl;
+
+    cout << Stats.Sites << " sites, " << Stats.Compiled << " compiled, "
+         << Stats.Hits << " hits, " << Stats.Fallbacks << " fallbacks, "
+         << Stats.Mismatches << " mismatches" << endl;
+}
+
 void NSBInterpreter::DebuggerTick()
 {
     if (DbgStepping || LogCalls)
@@ -74,6 +124,33 @@ void NSBInterpreter::DebuggerTick()
     }
 }
 
+/*
+ * Commands from the debugger thread which read or change variables,
+ * scripts or threads are queued and run at the start of the next round,
+ * when nothing else touches that state.
+ * */
+void NSBInterpreter::DbgQueue(function<void()> Request)
+{
+    lock_guard<mutex> Guard(DbgLock);
+    DbgRequests.push_back(Request);
+    DbgPending = true;
+}
+
+void NSBInterpreter::DbgRunRequests()
+{
+    if (!DbgPending)
+        return;
+
+    vector<function<void()>> Requests;
+    {
+        lock_guard<mutex> Guard(DbgLock);
+        Requests.swap(DbgRequests);
+        DbgPending = false;
+    }
+    for (auto& Request : Requests)
+        Request();
+}
+
 void NSBInterpreter::DbgBreak(bool Break)
 {
     if (Break) cout << "Breakpoint hit!" << endl;
@@ -83,13 +160,14 @@ void NSBInterpreter::DbgBreak(bool Break)
 
 void NSBInterpreter::Inspect(int32_t n)
 {
-    for (auto i : Threads)
+    for (auto i : Threads.GetThreads())
     {
         cout << "\nThread " << i->GetName() << ":\n";
-        ScriptFile* pScript = i->GetScript();
+        CompiledScript* pScript = i->GetScript();
         uint32_t SourceIter = i->GetLineNumber();
         for (uint32_t i = SourceIter - n; i < SourceIter + n + 1; ++i)
-            cout << ((i == SourceIter) ? " > " : "   ") << pScript->GetLine(i)->Stringify() << endl;
+            if (Instruction* pInstr = pScript->GetInstruction(i))
+                cout << ((i == SourceIter) ? " > " : "   ") << pInstr->pLine->Stringify() << endl;
     }
 }
 
@@ -119,14 +197,23 @@ void NSBInterpreter::DebuggerMain()
         // Log
         else if (Command == "l")
             LogCalls = !LogCalls;
+        // Fusion counters
+        else if (Command == "f")
+            PrintFusionStats();
+        // Expression compiler counters
+        else if (Command == "e")
+            PrintExpressionStats();
         // Thread Trace
         else if (Command == "t")
         {
-            for (auto i : Threads)
+            DbgQueue([this]
             {
-                cout << "\nThread " << i->GetName() << ":\n";
-                i->WriteTrace(cout);
-            }
+                for (auto i : Threads.GetThreads())
+                {
+                    cout << "\nThread " << i->GetName() << ":\n";
+                    i->WriteTrace(cout);
+                }
+            });
         }
         else
         {
@@ -138,41 +225,60 @@ void NSBInterpreter::DebuggerMain()
             {
                 try
                 {
-                    SetBreakpoint(Tokens[1], stoi(Tokens[2]));
+                    int32_t LineNumber = stoi(Tokens[2]);
+                    string Script = Tokens[1];
+                    DbgQueue([this, Script, LineNumber] { SetBreakpoint(Script, LineNumber); });
                 } catch (...) { cout << "Bad command!" << endl; }
             }
             // Breakpoint Clear
             else if (Tokens.size() == 2 && Tokens[0] == "b" && Tokens[1] == "c")
             {
-                Breakpoints.clear();
+                DbgQueue([this] { Breakpoints.clear(); });
+            }
+            // Watchpoint Clear
+            else if (Tokens.size() == 2 && Tokens[0] == "wp" && Tokens[1] == "c")
+            {
+                DbgQueue([this] { ClearWatchpoints(); });
+            }
+            // Watchpoint
+            else if (Tokens.size() == 2 && Tokens[0] == "wp")
+            {
+                string Name = Tokens[1];
+                DbgQueue([this, Name] { SetWatchpoint(Name); });
             }
             // Print
             else if (Tokens.size() == 2 && Tokens[0] == "p")
             {
-                PrintVariable(GetVar(Tokens[1]));
+                string Name = Tokens[1];
+                DbgQueue([this, Name] { PrintVariable(GetVar(Name)); });
             }
             // Print Array
             else if (Tokens.size() == 3 && Tokens[0] == "p" && Tokens[1] == "a")
             {
                 // TODO: print recursively
-                PrintVariable(GetVar(Tokens[2]));
+                string Name = Tokens[2];
+                DbgQueue([this, Name] { PrintVariable(GetVar(Name)); });
             }
             // Inspect surrounding code
             else if (Tokens.size() == 2 && Tokens[0] == "i")
             {
                 try
                 {
-                    Inspect(stoi(Tokens[1]));
+                    int32_t n = stoi(Tokens[1]);
+                    DbgQueue([this, n] { Inspect(n); });
                 } catch (...) { cout << "Bad command!" << endl; }
             }
             // Dump Variables
             else if (Tokens.size() == 2 && Tokens[0] == "d" && Tokens[1] == "v")
             {
-                for (auto i : VariableHolder.Cache)
+                DbgQueue([this]
                 {
-                    assert(i.first == i.second->Name);
-                    PrintVariable(i.second);
-                }
+                    for (auto& i : Variables.GetNames())
+                    {
+                        assert(i.first == i.second->Name);
+                        PrintVariable(i.second);
+                    }
+                });
             }
             else
                 cout << "Bad command!" << endl;
@@ -23,6 +23,9 @@
 #include "Movie.hpp"
 #include "Text.hpp"
 #include "Scrollbar.hpp"
+#include "CompiledScript.hpp"
+#include "ConstantCache.hpp"
+#include "Formatter.hpp"
 #include "nsbmagic.hpp"
 #include "nsbconstants.hpp"
 #include "scriptfile.hpp"
@@ -38,19 +41,74 @@
 #define NSB_ERROR(MSG1, MSG2) cout << __PRETTY_FUNCTION__ << ": " << MSG1 << " " << MSG2 << endl;
 #define NSB_VARARGS 0xFF
 
-extern "C" { void gst_init(int* argc, char** argv[]); }
+static int32_t NullToValue(const string& Str)
+{
+    return Nsb::ConstantToValue<Nsb::Null>(boost::algorithm::to_lower_copy(Str));
+}
+
+// Position kind shifted left by one, the low bit is set for vertical positions
+static int32_t SpecialPosition(const string& String)
+{
+    static const size_t SPECIAL_POS_NUM = 19;
+    static const struct
+    {
+        const char* Name;
+        uint8_t Kind;
+        bool Vertical;
+    } SpecialPos[SPECIAL_POS_NUM] =
+    {
+        {"outright", NSBPosition::OUT_END, false}, {"outleft", NSBPosition::OUT_START, false},
+        {"outtop", NSBPosition::OUT_START, true}, {"outbottom", NSBPosition::OUT_END, true},
+
+        {"inright", NSBPosition::IN_END, false}, {"inleft", NSBPosition::START, false},
+        {"intop", NSBPosition::START, true}, {"inbottom", NSBPosition::IN_END, true},
+
+        {"onright", NSBPosition::ON_END, false}, {"onleft", NSBPosition::ON_START, false},
+        {"ontop", NSBPosition::ON_START, true}, {"onbottom", NSBPosition::ON_END, true},
+
+        {"right", NSBPosition::END, false}, {"left", NSBPosition::START, false},
+        {"top", NSBPosition::START, true}, {"bottom", NSBPosition::END, true},
+
+        {"center", NSBPosition::CENTER, false}, {"middle", NSBPosition::CENTER, true},
+        {"auto", NSBPosition::AUTO, false}
+    };
+
+    string Str = boost::algorithm::to_lower_copy(String);
+    for (size_t i = 0; i < SPECIAL_POS_NUM; ++i)
+        if (Str == SpecialPos[i].Name)
+            return (SpecialPos[i].Kind << 1) | SpecialPos[i].Vertical;
+    return -1;
+}
+
+static int32_t ColorToValue(const string& String)
+{
+    string Str = boost::algorithm::to_lower_copy(String);
+    if (Nsb::IsValidConstant<Nsb::Color>(Str))
+        return Nsb::ConstantToValue<Nsb::Color>(Str);
+
+    size_t i = Str.find_first_of("0123456789abcdef");
+    if (i != Str.npos && Str.size() - i >= 6)
+        return stoi(Str.substr(i, 6), nullptr, 16) | (0xFF << 24);
+    return 0;
+}
 
 NSBInterpreter::NSBInterpreter(Window* pWindow) :
 pDebuggerThread(nullptr),
 LogCalls(false),
 DbgStepping(false),
 RunInterpreter(true),
+DbgPending(false),
+FusionHits(NUM_FUSED),
+FusionMisses(NUM_FUSED),
+Expressions({0, 0, 0, 0, 0}),
 SkipHack(false),
 pWindow(pWindow),
+pEngine(sEngine),
 pContext(nullptr),
-Builtins(MAGIC_UNK119 + 1, {nullptr, 0})
+Builtins(MAGIC_HANDLER_END, {nullptr, 0}),
+Quota(0),
+ArrayVariableId(sStringTable.Intern("__array_variable__"))
 {
-    gst_init(nullptr, nullptr);
     srand(time(0));
 
     Builtins[MAGIC_FUNCTION_DECLARATION] = { &NSBInterpreter::FunctionDeclaration, 0 };
@@ -156,6 +214,12 @@ Builtins(MAGIC_UNK119 + 1, {nullptr, 0})
     Builtins[MAGIC_CLEAR_BACKLOG] = { &NSBInterpreter::ClearBacklog, 0 };
     Builtins[MAGIC_SET_FONT] = { &NSBInterpreter::SetFont, 6 };
     Builtins[MAGIC_SET_SHORTCUT] = { &NSBInterpreter::SetShortcut, 2 };
+    Builtins[MAGIC_FUSED_COMPARE_BRANCH] = { &NSBInterpreter::FusedCompareBranch, 0 };
+    Builtins[MAGIC_FUSED_ASSIGN_LITERAL] = { &NSBInterpreter::FusedAssignLiteral, 0 };
+    Builtins[MAGIC_FUSED_ARITH_ASSIGN] = { &NSBInterpreter::FusedArithAssign, 0 };
+    Builtins[MAGIC_FUSED_INCREMENT] = { &NSBInterpreter::FusedIncrement, 0 };
+    Builtins[MAGIC_PROFILE_EXPRESSION] = { &NSBInterpreter::ProfileExpression, 0 };
+    Builtins[MAGIC_COMPILED_EXPRESSION] = { &NSBInterpreter::CompiledExpression, 0 };
     Builtins[MAGIC_CREATE_CLIP_TEXTURE] = { &NSBInterpreter::CreateClipTexture, 9 };
     Builtins[MAGIC_EXIST_SAVE] = { &NSBInterpreter::ExistSave, 1 };
     Builtins[MAGIC_WAIT_ACTION] = { &NSBInterpreter::WaitAction, NSB_VARARGS };
@@ -183,9 +247,16 @@ Builtins(MAGIC_UNK119 + 1, {nullptr, 0})
     Builtins[MAGIC_CREATE_STENCIL] = { &NSBInterpreter::CreateStencil, 7};
     Builtins[MAGIC_CREATE_MASK] = { &NSBInterpreter::CreateMask, 6};
 
+    InitInput();
+    Watch("#SYSTEM_window_full", [this] (Variable* pVar)
+    {
+        this->pWindow->SetFullscreen(ToBool(Value::MakeVariable(pVar)) ? SDL_WINDOW_FULLSCREEN : 0);
+    });
+
     pContext = new NSBContext("__main__");
     pContext->Start();
-    Threads.push_back(pContext);
+    Threads.Add(pContext);
+    pEngine->Timeline.Mark("interpreter");
 }
 
 NSBInterpreter::~NSBInterpreter()
@@ -194,29 +265,29 @@ NSBInterpreter::~NSBInterpreter()
         pDebuggerThread->join();
 
     delete pDebuggerThread;
-    for (NSBContext* pContext : Threads)
+    for (NSBContext* pContext : Threads.GetThreads())
         if (pContext->GetName() == "__main__" || pContext->GetName() == "UNK")
             delete pContext;
 }
 
 void NSBInterpreter::ExecuteLocalScript(const string& Filename)
 {
-    ScriptFile* pScript = new ScriptFile(Filename, ScriptFile::NSS);
-    for (const string& i : pScript->GetIncludes())
-        sResourceMgr->GetScriptFile(i);
+    CompiledScript* pScript = new CompiledScript(new ScriptFile(Filename, ScriptFile::NSS));
+    pEngine->pResourceMgr->QueueIncludes(pScript);
     pContext->Call(pScript, "chapter.main");
 }
 
 void NSBInterpreter::ExecuteScript(const string& Filename)
 {
     CallScript(Filename, "chapter.main");
+    pEngine->Timeline.Mark("boot script");
 }
 
 void NSBInterpreter::ExecuteScriptThread(const string& Filename)
 {
     NSBContext* pThread = new NSBContext("UNK");
     AddThread(pThread);
-    if (ScriptFile* pScript = sResourceMgr->GetScriptFile(Filename))
+    if (CompiledScript* pScript = pEngine->pResourceMgr->GetScript(Filename))
         pThread->Call(pScript, "chapter.main");
 }
 
@@ -226,45 +297,106 @@ void NSBInterpreter::Run(int NumCommands)
         RunCommand();
 }
 
+/*
+ * Run rounds over the ready threads until Budget microseconds have passed
+ * or every thread is waiting.
+ * */
+void NSBInterpreter::RunFor(uint32_t Budget)
+{
+    uint64_t Frequency = SDL_GetPerformanceFrequency();
+    uint64_t End = SDL_GetPerformanceCounter() + Frequency * Budget / 1000000;
+    do
+    {
+        RunCommand();
+    } while (RunInterpreter && Threads.GetNumReady() && SDL_GetPerformanceCounter() < End);
+}
+
+/*
+ * Number of instructions a thread may execute in one turn. It only yields
+ * at statement boundaries since the parameter stack is shared, so 0 means
+ * one statement per turn.
+ * */
+void NSBInterpreter::SetQuota(uint32_t Quota)
+{
+    this->Quota = Quota;
+}
+
+ExpressionStats NSBInterpreter::GetExpressionStats()
+{
+    ExpressionStats Stats = Expressions;
+    Stats.Sites = CompiledScript::ExpressionSites;
+    return Stats;
+}
+
 void NSBInterpreter::RunCommand()
 {
-    if (Threads.empty())
+    if (Threads.IsEmpty())
         Exit();
 
+    DbgRunRequests();
     if (!RunInterpreter)
         return;
 
-    ThreadsModified = false;
-    for (auto i = Threads.begin(); i != Threads.end(); ++i)
+    // One round over the threads which are ready now, new ones wait for the next.
+    // Threads deleted during the round leave the ready queue early.
+    pEngine->pResourceMgr->Poll();
+    Threads.Poll();
+    for (size_t n = Threads.GetNumReady(); n > 0; --n)
     {
-        pContext = *i;
-        pContext->TryWake();
+        NSBContext* pNext = Threads.Pop();
+        if (!pNext)
+            break;
+
+        pContext = pNext;
+        bool Removed = false;
+        uint32_t Executed = 0;
 
-        while (pContext->IsActive() && !pContext->IsStarving() && !pContext->IsSleeping() && pContext->Advance() != MAGIC_CLEAR_PARAMS)
+        while (pContext->IsActive() && !pContext->IsStarving() && !pContext->IsSleeping())
         {
+            Instruction* pInstr = pContext->Advance();
+            if (pInstr->Magic == MAGIC_CLEAR_PARAMS)
+            {
+                if (Executed >= Quota || !RunInterpreter)
+                    break;
+
+                ClearParams();
+                continue;
+            }
+
             if (pContext->GetName() == "__main__")
                 DebuggerTick();
 
-            if (pContext->GetMagic() < Builtins.size())
-                 Call(pContext->GetMagic());
+            // Superinstructions would step over lines the debugger wants to see
+            bool Trace = DbgStepping || LogCalls || !Breakpoints.empty();
+            uint16_t Magic = Trace ? pInstr->Magic : pInstr->Handler;
+            if (Magic < Builtins.size())
+                 Call(Magic);
+            Executed++;
+
+            // Thread deleted itself
+            if ((Removed = Threads.WasRemoved()))
+                break;
         }
 
         ClearParams();
+        if (Removed)
+            continue;
+
         if (pContext->IsStarving())
         {
-            ObjectHolder.Delete(pContext->GetName());
             RemoveThread(pContext);
+            ObjectHolder.Delete(pContext->GetName());
         }
-
-        if (ThreadsModified)
-            break;
+        else if (pContext->IsSleeping())
+            Threads.Suspend(pContext);
+        else
+            Threads.Requeue(pContext);
     }
 }
 
 void NSBInterpreter::Update(uint32_t Diff)
 {
-    for (NSBContext* pContext : Threads)
-        pContext->Update(Diff);
+    Threads.Update(Diff);
 }
 
 void NSBInterpreter::PushEvent(const SDL_Event& Event)
@@ -283,39 +415,40 @@ void NSBInterpreter::HandleEvent(const SDL_Event& Event)
     switch (Event.type)
     {
     case SDL_MOUSEBUTTONDOWN:
-        ProcessButton(Event.button.button, "true");
-        for (auto pContext : Threads)
-            pContext->OnClick();
+        ProcessButton(Event.button.button, true);
+        Threads.OnClick();
         break;
     case SDL_MOUSEBUTTONUP:
-        ProcessButton(Event.button.button, "false");
+        ProcessButton(Event.button.button, false);
         break;
     case SDL_KEYDOWN:
         if (Event.key.keysym.sym == SDLK_F1)
             SkipHack = !SkipHack;
 
-        ProcessKey(Event.key.keysym.sym, "true");
+        ProcessKey(Event.key.keysym.sym, true);
         for (NSBShortcut& Shortcut : Shortcuts)
             if (Shortcut.Key == Event.key.keysym.sym)
                 CallScriptThread(Shortcut.Script, "chapter.main");
         break;
     case SDL_KEYUP:
-        ProcessKey(Event.key.keysym.sym, "false");
+        ProcessKey(Event.key.keysym.sym, false);
         break;
     }
 }
 
-void NSBInterpreter::ProcessButton(int button, const string& Val)
+static const size_t NUM_KEYS = 128 + SDL_NUM_SCANCODES;
+
+// Characters map to themselves, other keys follow them ordered by scancode
+static size_t KeyIndex(SDL_Keycode Key)
 {
-    if (button == SDL_BUTTON_LEFT)
-        SetString("$SYSTEM_l_button_down", Val);
-    else if (button == SDL_BUTTON_RIGHT)
-        SetString("$SYSTEM_r_button_down", Val);
+    if (Key & SDLK_SCANCODE_MASK)
+        Key = (Key & ~SDLK_SCANCODE_MASK) + 128;
+    return Key >= 0 && size_t(Key) < NUM_KEYS ? Key : NUM_KEYS;
 }
 
-void NSBInterpreter::ProcessKey(int Key, const string& Val)
+void NSBInterpreter::InitInput()
 {
-    static const map<int, string> keydown =
+    static const pair<SDL_Keycode, const char*> Keys[] =
     {
         { SDLK_RCTRL, "$SYSTEM_keydown_ctrl" },
         { SDLK_KP_ENTER, "$SYSTEM_keydown_enter" },
@@ -326,7 +459,6 @@ void NSBInterpreter::ProcessKey(int Key, const string& Val)
         { SDLK_RIGHT, "$SYSTEM_keydown_right" },
         { SDLK_DOWN, "$SYSTEM_keydown_up" },
         { SDLK_UP, "$SYSTEM_keydown_down" },
-        { SDLK_ESCAPE, "$SYSTEM_keydown_esc" },
         { SDLK_HOME, "$SYSTEM_keydown_home" },
         { SDLK_PAGEDOWN, "$SYSTEM_keydown_pagedown" },
         { SDLK_PAGEUP, "$SYSTEM_keydown_pageup" },
@@ -334,15 +466,38 @@ void NSBInterpreter::ProcessKey(int Key, const string& Val)
         { SDLK_SPACE, "$SYSTEM_keydown_space" },
         { SDLK_TAB, "$SYSTEM_keydown_tab" }
     };
-    if (Key >= SDLK_a && Key <= SDLK_z)
-    {
-        char c = 'a' + Key - SDLK_a;
-        string Identifier = "$SYSTEM_keydown_" + string(1, c);
-        SetString(Identifier, Val);
-    }
-    auto it = keydown.find(Key);
-    if (it != keydown.end())
-        SetString(it->second, Val);
+
+    TrueId = sStringTable.Intern("true");
+    FalseId = sStringTable.Intern("false");
+    KeyVariables.assign(NUM_KEYS, nullptr);
+    for (SDL_Keycode Key = SDLK_a; Key <= SDLK_z; ++Key)
+        KeyVariables[KeyIndex(Key)] = GetVar("$SYSTEM_keydown_" + string(1, 'a' + Key - SDLK_a));
+    for (auto& Key : Keys)
+        KeyVariables[KeyIndex(Key.first)] = GetVar(Key.second);
+
+    pLeftButton = GetVar("$SYSTEM_l_button_down");
+    pRightButton = GetVar("$SYSTEM_r_button_down");
+}
+
+void NSBInterpreter::SetInput(Variable* pVar, bool Down)
+{
+    uint32_t Id = Down ? TrueId : FalseId;
+    pVar->Set(Value::MakeString(&sStringTable.Get(Id), Id));
+}
+
+void NSBInterpreter::ProcessButton(int button, bool Down)
+{
+    if (button == SDL_BUTTON_LEFT)
+        SetInput(pLeftButton, Down);
+    else if (button == SDL_BUTTON_RIGHT)
+        SetInput(pRightButton, Down);
+}
+
+void NSBInterpreter::ProcessKey(SDL_Keycode Key, bool Down)
+{
+    size_t Index = KeyIndex(Key);
+    if (Index < NUM_KEYS && KeyVariables[Index])
+        SetInput(KeyVariables[Index], Down);
 }
 
 void NSBInterpreter::FunctionDeclaration()
@@ -354,7 +509,13 @@ void NSBInterpreter::FunctionDeclaration()
 
 void NSBInterpreter::CallFunction()
 {
+    CallSite& Site = pContext->GetScript()->GetCallSite(pContext->GetInstruction());
+    if (CallCached(Site))
+        return;
+
+    size_t Depth = pContext->GetCallDepth();
     CallFunction_(pContext, pContext->GetParam(0));
+    CacheCall(Site, Depth);
 }
 
 void NSBInterpreter::CallScene()
@@ -379,52 +540,42 @@ void NSBInterpreter::CmpLogicalOr()
 
 void NSBInterpreter::LogicalGreaterEqual()
 {
-    if (Params.Top()->IsFloat() || Params.TTop()->IsFloat())
-        FloatBinaryOp(greater_equal<float>());
-    else
-        IntBinaryOp(greater_equal<int32_t>());
+    NumericBinaryOp<greater_equal>();
 }
 
 void NSBInterpreter::CmpGreater()
 {
-    if (Params.Top()->IsFloat() || Params.TTop()->IsFloat())
-        FloatBinaryOp(greater<float>());
-    else
-        IntBinaryOp(greater<int32_t>());
+    NumericBinaryOp<greater>();
 }
 
 void NSBInterpreter::CmpLess()
 {
-    if (Params.Top()->IsFloat() || Params.TTop()->IsFloat())
-        FloatBinaryOp(less<float>());
-    else
-        IntBinaryOp(less<int32_t>());
+    NumericBinaryOp<less>();
 }
 
 void NSBInterpreter::LogicalLessEqual()
 {
-    if (Params.Top()->IsFloat() || Params.TTop()->IsFloat())
-        FloatBinaryOp(less_equal<float>());
-    else
-        IntBinaryOp(less_equal<int32_t>());
+    NumericBinaryOp<less_equal>();
 }
 
 void NSBInterpreter::CmpEqual()
 {
-    Variable* pLhs = PopVar();
-    Variable* pRhs = PopVar();
+    Value Lhs = PopValue();
+    Value Rhs = PopValue();
 
     bool Equal = false;
-    if (pLhs->IsInt() && pRhs->IsInt())
-        Equal = pLhs->ToInt() == pRhs->ToInt();
-    else if (pLhs->IsString() && pRhs->IsString())
-        Equal = pLhs->ToString() == pRhs->ToString();
-    else if (pLhs->ToFloat() && pRhs->ToFloat())
-        Equal = pLhs->ToFloat() == pRhs->ToFloat();
+    if (Lhs.IsInt() && Rhs.IsInt())
+        Equal = Lhs.ToInt() == Rhs.ToInt();
+    else if (Lhs.IsString() && Rhs.IsString())
+    {
+        const string* pLhs = Lhs.GetString();
+        const string* pRhs = Rhs.GetString();
+        Equal = pLhs && pRhs ? *pLhs == *pRhs : Lhs.ToString() == Rhs.ToString();
+    }
+    else if (Lhs.IsFloat() || Rhs.IsFloat())
+        Equal = Lhs.ToFloat() == Rhs.ToFloat();
 
-    Variable::Destroy(pLhs);
-    Variable::Destroy(pRhs);
-    PushVar(Variable::MakeInt(Equal));
+    PushInt(Equal);
 }
 
 void NSBInterpreter::LogicalNotEqual()
@@ -435,43 +586,34 @@ void NSBInterpreter::LogicalNotEqual()
 
 void NSBInterpreter::LogicalNot()
 {
-    PushVar(Variable::MakeInt(!PopBool()));
+    PushInt(!PopBool());
 }
 
 void NSBInterpreter::AddExpression()
 {
-    if (Params.Top()->IsFloat() || Params.TTop()->IsFloat())
+    if (Params.Top().IsFloat() || Params.TTop().IsFloat())
         FloatBinaryOp(plus<float>());
     else
     {
-        Variable* pLhs = PopVar();
-        Variable* pRhs = PopVar();
-        PushVar(Variable::Add(pLhs, pRhs));
+        Value Lhs = PopValue();
+        Value Rhs = PopValue();
+        PushValue(AddValues(Lhs, Rhs));
     }
 }
 
 void NSBInterpreter::SubExpression()
 {
-    if (Params.Top()->IsFloat() || Params.TTop()->IsFloat())
-        FloatBinaryOp(minus<float>());
-    else
-        IntBinaryOp(minus<int32_t>());
+    NumericBinaryOp<minus>();
 }
 
 void NSBInterpreter::MulExpression()
 {
-    if (Params.Top()->IsFloat() || Params.TTop()->IsFloat())
-        FloatBinaryOp(multiplies<float>());
-    else
-        IntBinaryOp(multiplies<int32_t>());
+    NumericBinaryOp<multiplies>();
 }
 
 void NSBInterpreter::DivExpression()
 {
-    if (Params.Top()->IsFloat() || Params.TTop()->IsFloat())
-        FloatBinaryOp(divides<float>());
-    else
-        IntBinaryOp(divides<int32_t>());
+    NumericBinaryOp<divides>();
 }
 
 void NSBInterpreter::ModExpression()
@@ -481,7 +623,8 @@ void NSBInterpreter::ModExpression()
 
 void NSBInterpreter::Increment()
 {
-    if (Params.Top()->Name == "$SW_PHONE_SENDMAILNO")
+    Variable* pTop = Params.Top().GetVariable();
+    if (pTop && pTop->Name == "$SW_PHONE_SENDMAILNO")
     {
         Variable* pVar = PopVar();
         int32_t Index = Nsb::ConstantToValue<Nsb::PhoneMail>(pVar->ToString());
@@ -500,30 +643,36 @@ void NSBInterpreter::Decrement()
 
 void NSBInterpreter::Literal()
 {
-    const string& Type = pContext->GetParam(0);
-    const string& Val = pContext->GetParam(1);
-    if (Type == "STRING")
+    Instruction* pInstr = pContext->GetInstruction();
+    switch (pInstr->Type)
     {
-        if (Variable* pVar = VariableHolder.Read(Val))
-            PushVar(pVar);
-        else
-            PushString(Val);
+        case Instruction::OPERAND_STRING:
+        {
+            const string& Val = sStringTable.Get(pInstr->Str);
+            if (Variable* pVar = Variables.Read(pInstr->Str))
+                PushVar(pVar);
+            else
+                PushValue(Value::MakeString(&Val, pInstr->Str));
+            break;
+        }
+        case Instruction::OPERAND_INT:
+            PushInt(pInstr->Int);
+            break;
+        case Instruction::OPERAND_FLOAT:
+            PushFloat(pInstr->Float);
+            break;
     }
-    else if (Type == "INT")
-        PushInt(stoi(Val));
-    else if (Type == "FLOAT")
-        PushFloat(stof(Val));
 }
 
 void NSBInterpreter::Assign()
 {
-    if (pContext->GetParam(0) == "__array_variable__")
+    if (pContext->GetInstruction()->Str == ArrayVariableId)
     {
         Params.Begin(1);
         Variable* pVar = PopVar();
-        Variable* pLit = PopVar();
-        pVar->Set(pLit);
-        Variable::Destroy(pLit);
+        Value Lit = PopValue();
+        if (pVar)
+            pVar->Set(Lit);
     }
     else
         Assign_(0);
@@ -531,7 +680,167 @@ void NSBInterpreter::Assign()
 
 void NSBInterpreter::Get()
 {
-    PushVar(GetVar(pContext->GetParam(0)));
+    PushVar(GetVar(pContext->GetInstruction()->Str));
+}
+
+/*
+ * Superinstructions (see CompiledScript::Fuse). Each one runs the whole
+ * sequence starting at the current line and leaves the context on its last
+ * line. When the operands are not of the expected type, the original
+ * instructions are executed one by one instead.
+ * */
+void NSBInterpreter::FusedCompareBranch()
+{
+    Instruction* pInstr = pContext->GetInstruction();
+    Variable* pVar = GetVar(pInstr[0].Str);
+    if (!pVar->IsInt())
+    {
+        FusionMisses[MAGIC_FUSED_COMPARE_BRANCH - MAGIC_FUSED_BEGIN]++;
+        CallUnfused(4);
+        return;
+    }
+
+    int32_t Lhs = pVar->ToInt();
+    int32_t Rhs = pInstr[1].Int;
+    bool Cond = false;
+    switch (pInstr[2].Magic)
+    {
+        case MAGIC_CMP_EQUAL: Cond = Lhs == Rhs; break;
+        case MAGIC_LOGICAL_NOT_EQUAL: Cond = Lhs != Rhs; break;
+        case MAGIC_CMP_GREATER: Cond = Lhs > Rhs; break;
+        case MAGIC_CMP_LESS: Cond = Lhs < Rhs; break;
+        case MAGIC_LOGICAL_GREATER_EQUAL: Cond = Lhs >= Rhs; break;
+        case MAGIC_LOGICAL_LESS_EQUAL: Cond = Lhs <= Rhs; break;
+    }
+
+    FusionHits[MAGIC_FUSED_COMPARE_BRANCH - MAGIC_FUSED_BEGIN]++;
+    pContext->Advance();
+    pContext->Advance();
+    pContext->Advance();
+    if (!Cond)
+        pContext->JumpParam(0);
+}
+
+void NSBInterpreter::FusedAssignLiteral()
+{
+    Instruction* pInstr = pContext->GetInstruction();
+    Value Val = pInstr[0].Type == Instruction::OPERAND_INT ?
+        Value::MakeInt(pInstr[0].Int) : Value::MakeFloat(pInstr[0].Float);
+
+    FusionHits[MAGIC_FUSED_ASSIGN_LITERAL - MAGIC_FUSED_BEGIN]++;
+    pContext->Advance();
+    SetVar(pContext->GetParamId(0), Val);
+}
+
+void NSBInterpreter::FusedArithAssign()
+{
+    Instruction* pInstr = pContext->GetInstruction();
+    Variable* pVar = GetVar(pInstr[0].Str);
+    if (!pVar->IsInt())
+    {
+        FusionMisses[MAGIC_FUSED_ARITH_ASSIGN - MAGIC_FUSED_BEGIN]++;
+        CallUnfused(4);
+        return;
+    }
+
+    int32_t Result = pVar->ToInt();
+    if (pInstr[2].Magic == MAGIC_ADD_EXPRESSION)
+        Result += pInstr[1].Int;
+    else
+        Result -= pInstr[1].Int;
+
+    FusionHits[MAGIC_FUSED_ARITH_ASSIGN - MAGIC_FUSED_BEGIN]++;
+    pContext->Advance();
+    pContext->Advance();
+    pContext->Advance();
+    SetVar(pContext->GetParamId(0), Value::MakeInt(Result));
+}
+
+void NSBInterpreter::FusedIncrement()
+{
+    Instruction* pInstr = pContext->GetInstruction();
+    Variable* pVar = GetVar(pInstr[0].Str);
+    int32_t Delta = pInstr[1].Magic == MAGIC_INCREMENT ? 1 : -1;
+
+    FusionHits[MAGIC_FUSED_INCREMENT - MAGIC_FUSED_BEGIN]++;
+    pVar->Set(pVar->ToInt() + Delta);
+    PushVar(pVar);
+    pContext->Advance();
+}
+
+/*
+ * Expression statements (see Expression) run normally until they have been
+ * executed Threshold times, then they are compiled and the statement is
+ * evaluated in one go. Like superinstructions, the context is left on the
+ * last line of the statement.
+ * */
+void NSBInterpreter::ProfileExpression()
+{
+    Instruction* pInstr = pContext->GetInstruction();
+    Expression& Expr = pContext->GetScript()->GetExpression(pInstr);
+    if (++Expr.Count < Expression::Threshold)
+    {
+        Call(pInstr->Magic);
+        return;
+    }
+
+    // Run the statement both ways and only switch to the compiled version
+    // once it has produced the same value as the interpreter
+    if (!Expr.IsCompiled())
+        Expr.Compile(pInstr);
+    int32_t Result;
+    bool Evaluated = Expr.Evaluate(Variables, Result);
+    Call(pInstr->Magic);
+    for (uint32_t i = 2; i < Expr.GetLength(); ++i)
+        Call(pContext->Advance()->Magic);
+
+    const Value& Val = Params.Back();
+    if (Evaluated && Val.IsInt())
+    {
+        if (Val.ToInt() == Result)
+        {
+            pInstr->Handler = MAGIC_COMPILED_EXPRESSION;
+            Expressions.Compiled++;
+        }
+        else
+        {
+            NSB_ERROR("Compiled expression mismatch in", pContext->GetScript()->GetName());
+            pInstr->Handler = pInstr->Magic;
+            Expressions.Mismatches++;
+        }
+    }
+    Call(pContext->Advance()->Magic);
+}
+
+void NSBInterpreter::CompiledExpression()
+{
+    Instruction* pInstr = pContext->GetInstruction();
+    Expression& Expr = pContext->GetScript()->GetExpression(pInstr);
+    int32_t Result;
+    if (!Expr.Evaluate(Variables, Result))
+    {
+        Expressions.Fallbacks++;
+        CallUnfused(Expr.GetLength());
+        return;
+    }
+
+    Expressions.Hits++;
+    for (uint32_t i = 1; i < Expr.GetLength(); ++i)
+        pContext->Advance();
+
+    switch (pContext->GetMagic())
+    {
+        case MAGIC_ASSIGN:
+            SetVar(pContext->GetParamId(0), Value::MakeInt(Result));
+            break;
+        case MAGIC_WHILE:
+            pContext->PushBreak();
+            // Fall through
+        case MAGIC_IF:
+            if (!Result)
+                pContext->JumpParam(0);
+            break;
+    }
 }
 
 void NSBInterpreter::ScopeBegin()
@@ -594,14 +903,19 @@ void NSBInterpreter::Break()
 
 void NSBInterpreter::Jump()
 {
-    pContext->Jump(pContext->GetParam(0));
+    pContext->JumpParam(0);
 }
 
-Variable* NSBInterpreter::PopVar()
+Value NSBInterpreter::PopValue()
 {
     return Params.Pop();
 }
 
+Variable* NSBInterpreter::PopVar()
+{
+    return Params.Pop().GetVariable();
+}
+
 Texture* NSBInterpreter::PopTexture()
 {
     return Get<Texture>(PopString());
@@ -624,158 +938,88 @@ Scrollbar* NSBInterpreter::PopScrollbar()
 
 int32_t NSBInterpreter::PopInt()
 {
-    Variable* pVar = PopVar();
-    int32_t Val = 0;
-    if (pVar->IsInt())
-        Val = pVar->ToInt();
-    else
-        Val = Nsb::ConstantToValue<Nsb::Null>(boost::algorithm::to_lower_copy(pVar->ToString()));
-    Variable::Destroy(pVar);
-    return Val;
+    Value Val = PopValue();
+    if (Val.IsInt())
+        return Val.ToInt();
+    return ConstantCache<NullToValue>::Get(Val);
 }
 
 float NSBInterpreter::PopFloat()
 {
-    Variable* pVar = PopVar();
-    float Val = pVar->ToFloat();
-    Variable::Destroy(pVar);
-    return Val;
+    return PopValue().ToFloat();
 }
 
 string NSBInterpreter::PopString()
 {
-    Variable* pVar = PopVar();
-    string Val = pVar->ToString();
-    Variable::Destroy(pVar);
-    return Val;
+    return PopValue().ToString();
 }
 
 NSBPosition NSBInterpreter::PopPos()
 {
-    const int32_t WIDTH = pWindow->WIDTH;
-    const int32_t HEIGHT = pWindow->HEIGHT;
-    static const size_t SPECIAL_POS_NUM = 19;
-    static const PosFunc SpecialPosTable[SPECIAL_POS_NUM] =
-    {
-        [WIDTH] (int32_t x) { return WIDTH; }, // OutRight
-        [] (int32_t x) { return -x; }, // OutLeft
-        [] (int32_t y) { return -y; }, // OutTop
-        [HEIGHT] (int32_t y) { return HEIGHT; }, // OutBottom
-
-        [WIDTH] (int32_t x) { return WIDTH - x; }, // InRight
-        [] (int32_t x) { return 0; }, // InLeft
-        [] (int32_t y) { return 0; }, // InTop
-        [HEIGHT] (int32_t y) { return HEIGHT - y; }, // InBottom
-
-        [WIDTH] (int32_t x) { return WIDTH - (x / 2); }, // OnRight
-        [] (int32_t x) { return -(x / 2); }, // OnLeft
-        [] (int32_t y) { return -(y / 2); }, // OnTop
-        [HEIGHT] (int32_t y) { return HEIGHT - (y / 2); }, // OnBottom
-
-        [] (int32_t x) { return x; }, // Right
-        [] (int32_t x) { return 0; }, // Left
-        [] (int32_t y) { return 0; }, // Top
-        [] (int32_t y) { return y; }, // Bottom
-
-        [WIDTH] (int32_t x) { return (WIDTH - x) / 2; }, // Center
-        [HEIGHT] (int32_t y) { return (HEIGHT - y) / 2; }, // Middle
-        [] (int32_t xy) { return numeric_limits<int32_t>::max(); } // Auto
-    };
-    static const string SpecialPos[SPECIAL_POS_NUM] =
-    {
-        "outright", "outleft", "outtop", "outbottom",
-        "inright", "inleft", "intop", "inbottom",
-        "onright", "onleft", "ontop", "onbottom",
-        "right", "left", "top", "bottom",
-        "center", "middle", "auto"
-    };
-
     NSBPosition Position;
-    Variable* pVar = PopVar();
-    Position.Relative = pVar->Relative;
-    if (pVar->IsInt())
+    Value Val = PopValue();
+    Position.Relative = Val.IsRelative();
+    if (Val.IsInt())
     {
-        int32_t Val = pVar->ToInt();
-        Position.Func = [Val] (int32_t) { return Val; };
+        Position.Int = Val.ToInt();
+        return Position;
     }
-    else
+
+    // Unknown names stay at 0
+    int32_t Special = ConstantCache<SpecialPosition>::Get(Val);
+    if (Special != -1)
     {
-        string Str = pVar->ToString();
-        transform(Str.begin(), Str.end(), Str.begin(), ::tolower);
-        size_t i = -1;
-        while (++i < SPECIAL_POS_NUM)
-            if (Str == SpecialPos[i])
-                Position.Func = SpecialPosTable[i];
+        Position.Kind = Special >> 1;
+        Position.Int = (Special & 1) ? pWindow->HEIGHT : pWindow->WIDTH;
     }
-    Variable::Destroy(pVar);
     return Position;
 }
 
 NSBPosition NSBInterpreter::PopRelative()
 {
     NSBPosition Position;
-    Variable* pVar = PopVar();
-    Position.Relative = pVar->Relative;
-    int32_t Val = pVar->ToInt();
-    Position.Func = [Val] (int32_t) { return Val; };
-    Variable::Destroy(pVar);
+    Value Val = PopValue();
+    Position.Relative = Val.IsRelative();
+    Position.Int = Val.ToInt();
     return Position;
 }
 
 uint32_t NSBInterpreter::PopColor()
 {
-    uint32_t Color = 0;
-    Variable* pVar = PopVar();
-    if (pVar->IsString())
-    {
-        string Str = boost::algorithm::to_lower_copy(pVar->ToString());
-        if (Nsb::IsValidConstant<Nsb::Color>(Str))
-            Color = Nsb::ConstantToValue<Nsb::Color>(Str);
-        else
-        {
-            size_t i = Str.find_first_of("0123456789abcdef");
-            if (i != Str.npos && Str.size() - i >= 6)
-                Color = stoi(Str.substr(i, 6), nullptr, 16) | (0xFF << 24);
-        }
-    }
-    else
-        Color = stoi(to_string(pVar->ToInt()), nullptr, 16) | (0xFF << 24);
-
-    Variable::Destroy(pVar);
-    return Color;
+    Value Val = PopValue();
+    if (Val.IsString())
+        return ConstantCache<ColorToValue>::Get(Val);
+    return stoi(to_string(Val.ToInt()), nullptr, 16) | (0xFF << 24);
 }
 
 int32_t NSBInterpreter::PopRequest()
 {
-    return Nsb::ConstantToValue<Nsb::Request>(PopString());
+    return ConstantCache<Nsb::ConstantToValue<Nsb::Request>>::Get(PopValue());
 }
 
 int32_t NSBInterpreter::PopTone()
 {
-    return Nsb::ConstantToValue<Nsb::Tone>(PopString());
+    return ConstantCache<Nsb::ConstantToValue<Nsb::Tone>>::Get(PopValue());
 }
 
 int32_t NSBInterpreter::PopEffect()
 {
-    return Nsb::ConstantToValue<Nsb::Effect>(PopString());
+    return ConstantCache<Nsb::ConstantToValue<Nsb::Effect>>::Get(PopValue());
 }
 
 int32_t NSBInterpreter::PopShade()
 {
-    return Nsb::ConstantToValue<Nsb::Shade>(PopString());
+    return ConstantCache<Nsb::ConstantToValue<Nsb::Shade>>::Get(PopValue());
 }
 
 int32_t NSBInterpreter::PopTempo()
 {
-    return Nsb::ConstantToValue<Nsb::Tempo>(PopString());
+    return ConstantCache<Nsb::ConstantToValue<Nsb::Tempo>>::Get(PopValue());
 }
 
 bool NSBInterpreter::PopBool()
 {
-    Variable* pVar = PopVar();
-    bool ret = ToBool(pVar);
-    Variable::Destroy(pVar);
-    return ret;
+    return ToBool(PopValue());
 }
 
 string NSBInterpreter::PopSave()
@@ -788,63 +1032,131 @@ string NSBInterpreter::PopSave()
 
 void NSBInterpreter::PushFloat(float Float)
 {
-    PushVar(Variable::MakeFloat(Float));
+    Params.Push(Value::MakeFloat(Float));
 }
 
 void NSBInterpreter::PushInt(int32_t Int)
 {
-    PushVar(Variable::MakeInt(Int));
+    Params.Push(Value::MakeInt(Int));
 }
 
 void NSBInterpreter::PushString(const string& Str)
 {
-    PushVar(Variable::MakeString(Str));
+    string& Temp = Params.NewString();
+    Temp = Str;
+    Params.Push(Value::MakeString(&Temp));
 }
 
 void NSBInterpreter::PushVar(Variable* pVar)
 {
-    Params.Push(pVar);
+    Params.Push(Value::MakeVariable(pVar));
+}
+
+void NSBInterpreter::PushValue(const Value& Val)
+{
+    Params.Push(Val);
 }
 
 void NSBInterpreter::Assign_(int Index)
 {
-    SetVar(pContext->GetParam(Index), PopVar());
+    SetVar(pContext->GetParamId(Index), PopValue());
 }
 
-void NSBInterpreter::IntUnaryOp(function<int32_t(int32_t)> Func)
+Value NSBInterpreter::AddValues(const Value& Lhs, const Value& Rhs)
 {
-    PushVar(PopVar()->IntUnaryOp(Func));
+    if (Lhs.IsInt())
+        return Value::MakeInt(Lhs.ToInt() + Rhs.ToInt());
+
+    if (!Lhs.IsString())
+        return Value::MakeNull();
+
+    string& Str = Params.NewString();
+    Lhs.AppendTo(Str);
+    Rhs.AppendTo(Str);
+    return Value::MakeString(&Str);
 }
 
-void NSBInterpreter::IntBinaryOp(function<int32_t(int32_t, int32_t)> Func)
+template <class T> void NSBInterpreter::IntUnaryOp(T Func)
+{
+    Value Val = PopValue();
+    int32_t Result = Func(Val.ToInt());
+    if (Variable* pVar = Val.GetVariable())
+    {
+        pVar->Set(Result);
+        PushVar(pVar);
+    }
+    else
+        PushInt(Result);
+}
+
+template <class T> void NSBInterpreter::IntBinaryOp(T Func)
 {
     int32_t lhs = PopInt();
     int32_t rhs = PopInt();
     PushInt(Func(lhs, rhs));
 }
 
-void NSBInterpreter::FloatBinaryOp(function<float(float, float)> Func)
+template <class T> void NSBInterpreter::FloatBinaryOp(T Func)
 {
     float lhs = PopFloat();
     float rhs = PopFloat();
     PushFloat(Func(lhs, rhs));
 }
 
-void NSBInterpreter::BoolBinaryOp(function<bool(bool, bool)> Func)
+template <class T> void NSBInterpreter::BoolBinaryOp(T Func)
 {
     bool lhs = PopBool();
     bool rhs = PopBool();
     PushInt(Func(lhs, rhs));
 }
 
+/*
+ * Operators are passed as function objects so each builtin gets its own
+ * inlined kernel; the operand tags pick the float or integer version.
+ * */
+template <template <class> class T> void NSBInterpreter::NumericBinaryOp()
+{
+    if (Params.Top().IsFloat() || Params.TTop().IsFloat())
+        FloatBinaryOp(T<float>());
+    else
+        IntBinaryOp(T<int32_t>());
+}
+
 void NSBInterpreter::CallFunction_(NSBContext* pThread, const string& Symbol)
 {
     if (!pThread->Call(pContext->GetScript(), string("function.") + Symbol))
         NSB_ERROR("Failed to call function", Symbol);
 }
 
+/*
+ * Call the target this call site resolved last time, unless a script was
+ * loaded since then (which may shadow or provide the symbol).
+ * */
+bool NSBInterpreter::CallCached(CallSite& Site)
+{
+    if (Site.Generation != pEngine->pResourceMgr->GetGeneration())
+        return false;
+
+    pContext->Call(Site.pScript, Site.CodeLine);
+    return true;
+}
+
+void NSBInterpreter::CacheCall(CallSite& Site, size_t Depth)
+{
+    if (pContext->GetCallDepth() > Depth)
+        Site = {pContext->GetScript(), pContext->GetLineNumber() + 1, pEngine->pResourceMgr->GetGeneration()};
+}
+
 void NSBInterpreter::CallScriptSymbol(const string& Prefix)
 {
+    // Target names read from a variable may change between calls
+    const string& Param = pContext->GetParam(0);
+    bool Cacheable = Param[0] != '$' && Param[0] != '#';
+    CallSite& Site = pContext->GetScript()->GetCallSite(pContext->GetInstruction());
+    if (Cacheable && CallCached(Site))
+        return;
+
+    size_t Depth = pContext->GetCallDepth();
     string ScriptName = GetString(pContext->GetParam(0)), Symbol;
     size_t i = ScriptName.find("->");
     if (i != string::npos)
@@ -854,12 +1166,24 @@ void NSBInterpreter::CallScriptSymbol(const string& Prefix)
     }
     else
         Symbol = "main";
-    CallScript(ScriptName == "@" ? pContext->GetScriptName() : ScriptName, Prefix + Symbol);
+    if (ScriptName == "@")
+        ScriptName = pContext->GetScriptName();
+
+    // Sleep until a worker has loaded the script, then run this line again
+    if (Object* pLoading = pEngine->pResourceMgr->LoadScript(ScriptName))
+    {
+        pContext->Rewind();
+        pContext->WaitAction(pLoading, -1);
+        return;
+    }
+    CallScript(ScriptName, Prefix + Symbol);
+    if (Cacheable)
+        CacheCall(Site, Depth);
 }
 
 void NSBInterpreter::CallScript(const string& Filename, const string& Symbol)
 {
-    if (ScriptFile* pScript = sResourceMgr->GetScriptFile(Filename))
+    if (CompiledScript* pScript = pEngine->pResourceMgr->GetScript(Filename))
         pContext->Call(pScript, Symbol);
 }
 
@@ -867,7 +1191,7 @@ void NSBInterpreter::CallScriptThread(const string& Filename, const string& Symb
 {
     NSBContext* pThread = new NSBContext("UNK");
     AddThread(pThread);
-    if (ScriptFile* pScript = sResourceMgr->GetScriptFile(Filename))
+    if (CompiledScript* pScript = pEngine->pResourceMgr->GetScript(Filename))
         pThread->Call(pScript, Symbol);
 }
 
@@ -880,6 +1204,13 @@ void NSBInterpreter::Call(uint16_t Magic)
         (this->*Builtins[Magic].Func)();
 }
 
+void NSBInterpreter::CallUnfused(uint32_t Count)
+{
+    Call(pContext->GetMagic());
+    while (--Count)
+        Call(pContext->Advance()->Magic);
+}
+
 bool NSBInterpreter::SelectEvent()
 {
     if (!Events.empty())
@@ -899,14 +1230,12 @@ bool NSBInterpreter::SelectEvent()
 void NSBInterpreter::AddThread(NSBContext* pThread)
 {
     pThread->Start();
-    Threads.push_back(pThread);
-    ThreadsModified = true;
+    Threads.Add(pThread);
 }
 
 void NSBInterpreter::RemoveThread(NSBContext* pThread)
 {
-    Threads.remove(pThread);
-    ThreadsModified = true;
+    Threads.Remove(pThread);
 }
 
 int32_t NSBInterpreter::GetInt(const string& Name)
@@ -916,7 +1245,7 @@ int32_t NSBInterpreter::GetInt(const string& Name)
 
 bool NSBInterpreter::GetBool(const string& Name)
 {
-    return ToBool(GetVar(Name));
+    return ToBool(Value::MakeVariable(GetVar(Name)));
 }
 
 string NSBInterpreter::GetString(const string& Name)
@@ -926,25 +1255,25 @@ string NSBInterpreter::GetString(const string& Name)
     return GetVar(Name)->ToString();
 }
 
-bool NSBInterpreter::ToBool(Variable* pVar)
+bool NSBInterpreter::ToBool(const Value& Val)
 {
-    if (pVar->IsString())
+    if (Val.GetString())
     {
-        int32_t Val = Nsb::ConstantToValue<Nsb::Boolean>(pVar->ToString());
-        if (Val != -1)
-            return static_cast<bool>(Val);
+        int32_t Bool = BooleanCache::Get(Val);
+        if (Bool != -1)
+            return static_cast<bool>(Bool);
     }
-    return static_cast<bool>(pVar->ToInt());
+    return static_cast<bool>(Val.ToInt());
 }
 
 Variable* NSBInterpreter::GetVar(const string& Name)
 {
-    if (Variable* pVar = VariableHolder.Read(Name))
-        return pVar;
+    return Variables.Get(Name);
+}
 
-    Variable* pVar = Variable::MakeNull(Name);
-    VariableHolder.Write(Name, pVar);
-    return pVar;
+Variable* NSBInterpreter::GetVar(uint32_t Id)
+{
+    return Variables.Get(Id);
 }
 
 Object* NSBInterpreter::GetObject(const string& Name)
@@ -952,43 +1281,46 @@ Object* NSBInterpreter::GetObject(const string& Name)
     return ObjectHolder.Read(Name);
 }
 
-void NSBInterpreter::OnVariableChanged(const string& Name)
+uint32_t NSBInterpreter::Watch(const string& Name, VariableHook Hook)
+{
+    return GetVar(Name)->AddHook(Hook);
+}
+
+void NSBInterpreter::Unwatch(const string& Name, uint32_t Hook)
+{
+    GetVar(Name)->RemoveHook(Hook);
+}
+
+void NSBInterpreter::SetVar(const string& Name, const Value& Val)
 {
-    if (Name == "#SYSTEM_window_full")
-        pWindow->SetFullscreen(GetBool("#SYSTEM_window_full") ? SDL_WINDOW_FULLSCREEN : 0);
+    GetVar(Name)->Set(Val);
 }
 
-void NSBInterpreter::SetVar(const string& Name, Variable* pVar)
+void NSBInterpreter::SetVar(uint32_t Id, const Value& Val)
 {
-    GetVar(Name)->Set(pVar);
-    OnVariableChanged(Name);
-    Variable::Destroy(pVar);
+    GetVar(Id)->Set(Val);
 }
 
 void NSBInterpreter::SetInt(const string& Name, int32_t Val)
 {
-    SetVar(Name, Variable::MakeInt(Val));
+    GetVar(Name)->Set(Val);
 }
 
 void NSBInterpreter::SetString(const string& Name, const string& Val)
 {
-    SetVar(Name, Variable::MakeString(Val));
+    GetVar(Name)->Set(Val);
 }
 
 void NSBInterpreter::AddAssign()
 {
-    Variable* pVar = GetVar(pContext->GetParam(0));
-    Variable* pTemp = Variable::Add(pVar, PopVar());
-    pVar->Set(pTemp);
-    Variable::Destroy(pTemp);
+    Variable* pVar = GetVar(pContext->GetInstruction()->Str);
+    pVar->Set(AddValues(Value::MakeVariable(pVar), PopValue()));
 }
 
 void NSBInterpreter::SubAssign()
 {
-    Variable* pVar = GetVar(pContext->GetParam(0));
-    Variable* pTemp = Variable::MakeInt(pVar->ToInt() - PopInt());
-    pVar->Set(pTemp);
-    Variable::Destroy(pTemp);
+    Variable* pVar = GetVar(pContext->GetInstruction()->Str);
+    pVar->Set(pVar->ToInt() - PopInt());
 }
 
 void NSBInterpreter::WriteFile()
@@ -1105,7 +1437,7 @@ void NSBInterpreter::WaitKey()
 
 void NSBInterpreter::NegaExpression()
 {
-    IntUnaryOp(negate<int32_t>());
+    PushInt(-PopInt());
 }
 
 void NSBInterpreter::System()
@@ -1125,17 +1457,28 @@ void NSBInterpreter::System()
 
 void NSBInterpreter::String()
 {
-    boost::format Fmt(PopString());
+    Value Format = PopValue();
+    FormatArgs.clear();
     for (int i = 1; i < pContext->GetNumParams(); ++i)
+        FormatArgs.push_back(PopValue());
+
+    if (Formatter* pFormatter = Formatter::Get(Format))
     {
-        Variable* pVar = PopVar();
-        if (pVar->IsInt())
-            Fmt % pVar->ToInt();
-        else if (pVar->IsString())
-            Fmt % pVar->ToString();
-        else if (pVar->IsFloat())
-            Fmt % pVar->ToFloat();
-        Variable::Destroy(pVar);
+        string& Str = Params.NewString();
+        pFormatter->Format(FormatArgs, Str);
+        Params.Push(Value::MakeString(&Str));
+        return;
+    }
+
+    boost::format Fmt(Format.ToString());
+    for (const Value& Val : FormatArgs)
+    {
+        if (Val.IsInt())
+            Fmt % Val.ToInt();
+        else if (Val.IsString())
+            Fmt % Val.ToString();
+        else if (Val.IsFloat())
+            Fmt % Val.ToFloat();
     }
     PushString(Fmt.str());
 }
@@ -1147,9 +1490,9 @@ void NSBInterpreter::VariableValue()
 
     // Check if it's array index. Not sure about this...
     if (Name.size() > 3 && Name[Name.size() - 3] == '[' && Name.back() == ']' && isdigit(Name[Name.size() - 2]))
-        PushVar(GetVar(Name.substr(0, Name.size() - 3) + "/" + to_string(Name[Name.size() - 2])));
+        PushVar(GetVar(Name.substr(0, Name.size() - 3) + "/" + Name[Name.size() - 2]));
     else if (pContext->GetNumParams() == 3)
-        SetVar(Type + Name, PopVar());
+        SetVar(Type + Name, PopValue());
     else if (pContext->GetNumParams() == 2)
         PushVar(GetVar(Type + Name));
     else
@@ -1173,16 +1516,13 @@ void NSBInterpreter::CreateProcess()
 void NSBInterpreter::Count()
 {
     Variable* pArr = PopVar();
-    int SCount = count(pArr->Name.begin(), pArr->Name.end(), '/') + 1;
-    int32_t Size = 0;
-    for (auto& i : VariableHolder.Cache)
+    if (!pArr)
     {
-        string Prefix = i.first.substr(0, pArr->Name.size());
-        int Count = count(i.first.begin(), i.first.end(), '/');
-        if (Prefix == pArr->Name && SCount == Count)
-            Size++;
+        PushInt(0);
+        return;
     }
-    PushInt(Size);
+
+    PushInt(pArr->Count());
 }
 
 void NSBInterpreter::Array()
@@ -1190,28 +1530,30 @@ void NSBInterpreter::Array()
     Variable* pArr = PopVar();
     if (!pArr)
     {
-        pArr = Variable::MakeNull(pContext->GetParam(0));
-        VariableHolder.Write(pContext->GetParam(0), pArr);
+        pArr = GetVar(pContext->GetInstruction()->Str);
     }
     for (int i = 1; i < pContext->GetNumParams(); ++i)
     {
-        string Name = pArr->Name + "/" + to_string(i - 1);
-        Variable* pVar = Variable::MakeCopy(PopVar(), Name);
-        VariableHolder.Write(Name, pVar);
+        Variable* pVar = Variables.GetElement(pArr, i - 1);
+        pVar->Set(PopValue());
+        pVar->ClearKeys();
     }
 }
 
 void NSBInterpreter::SubScript()
 {
-    Variable* pArr = GetVar(pContext->GetParam(0));
+    Variable* pArr = GetVar(pContext->GetInstruction()->Str);
     int32_t Depth = stoi(pContext->GetParam(1));
     Params.Begin(Depth);
     while (Depth --> 0)
     {
-        Variable* pVar = PopVar();
-        int Index = pVar->IsInt() ? pVar->ToInt() : pArr->Assoc[pVar->ToString()];
-        pArr = GetVar(pArr->Name + "/" + to_string(Index));
-        Variable::Destroy(pVar);
+        Value Val = PopValue();
+        int32_t Index = 0;
+        if (Val.IsInt())
+            Index = Val.ToInt();
+        else
+            pArr->GetKey(Val.ToString(), Index);
+        pArr = Variables.GetElement(pArr, Index);
     }
     PushVar(pArr);
 }
@@ -1219,8 +1561,11 @@ void NSBInterpreter::SubScript()
 void NSBInterpreter::AssocArray()
 {
     Variable* pArr = PopVar();
+    if (!pArr)
+        return;
+
     for (int i = 1; i < pContext->GetNumParams(); ++i)
-        pArr->Assoc[PopString()] = i - 1;
+        pArr->SetKey(PopString(), i - 1);
 }
 
 void NSBInterpreter::ModuleFileName()
@@ -1260,10 +1605,9 @@ void NSBInterpreter::Zoom()
     /*int32_t Tempo = */PopTempo();
     bool Wait = PopBool();
 
-    ObjectHolder.Execute(Handle, [&] (Object** ppObject)
+    ObjectHolder.ExecuteAs<Texture>(Handle, [&] (Texture* pTexture)
     {
-        if (Texture* pTexture = dynamic_cast<Texture*>(*ppObject))
-            pTexture->Zoom(Time, XScale(0, pTexture->GetXScale()), YScale(0, pTexture->GetYScale()));
+        pTexture->Zoom(Time, XScale(0, pTexture->GetXScale()), YScale(0, pTexture->GetYScale()));
     });
 
     if (Wait)
@@ -1279,10 +1623,9 @@ void NSBInterpreter::Move()
     /*int32_t Tempo = */PopTempo();
     bool Wait = PopBool();
 
-    ObjectHolder.Execute(Handle, [&] (Object** ppObject)
+    ObjectHolder.ExecuteAs<Texture>(Handle, [&] (Texture* pTexture)
     {
-        if (Texture* pTexture = dynamic_cast<Texture*>(*ppObject))
-            pTexture->Move(X(pTexture->GetWidth(), pTexture->GetMX()), Y(pTexture->GetHeight(), pTexture->GetMY()), Time);
+        pTexture->Move(X(pTexture->GetWidth(), pTexture->GetMX()), Y(pTexture->GetHeight(), pTexture->GetMY()), Time);
     });
 
     if (Wait)
@@ -1377,10 +1720,9 @@ void NSBInterpreter::Fade()
     /*int32_t Tempo = */PopTempo();
     bool Wait = PopBool();
 
-    ObjectHolder.Execute(Handle, [Time, Opacity] (Object** ppObject)
+    ObjectHolder.ExecuteAs<Texture>(Handle, [Time, Opacity] (Texture* pTexture)
     {
-        if (Texture* pTexture = dynamic_cast<Texture*>(*ppObject))
-            pTexture->Fade(Time, Opacity);
+        pTexture->Fade(Time, Opacity);
     });
 
     if (Wait)
@@ -1398,11 +1740,12 @@ void NSBInterpreter::Delete()
             if (pObject->Lock)
                 return;
 
-            if (NSBContext* pThread = dynamic_cast<NSBContext*>(pObject))
+            if (NSBContext* pThread = pObject->As<NSBContext>())
                 RemoveThread(pThread);
 
             delete pObject;
             *ppObject = nullptr;
+            ObjectHolder.Invalidate();
         }
     });
 }
@@ -1425,10 +1768,9 @@ void NSBInterpreter::SetVolume()
     int32_t Volume = PopInt();
     /*int32_t Tempo = */PopTempo();
 
-    ObjectHolder.Execute(Handle, [Time, Volume] (Object** ppObject)
+    ObjectHolder.ExecuteAs<Playable>(Handle, [Time, Volume] (Playable* pPlayable)
     {
-        if (Playable* pPlayable = dynamic_cast<Playable*>(*ppObject))
-            pPlayable->SetVolume(Time, Volume);
+        pPlayable->SetVolume(Time, Volume);
     });
 }
 
@@ -1451,7 +1793,7 @@ void NSBInterpreter::CreateSound()
     if (File.substr(File.size() - 4) != ".ogg")
         File += ".ogg";
 
-    Resource Res = sResourceMgr->GetResource(File);
+    Resource Res = pEngine->pResourceMgr->GetResource(File);
     if (!Res.IsValid())
         return;
 
@@ -1575,7 +1917,7 @@ void NSBInterpreter::Case()
         pChoice->Reset();
     }
 
-    pContext->Jump(Choose ? pContext->GetParam(2) : pContext->GetParam(1));
+    pContext->JumpParam(Choose ? 2 : 1);
 }
 
 void NSBInterpreter::CaseEnd()
@@ -1625,8 +1967,8 @@ void NSBInterpreter::LoadText()
 
     if (Text* pText = Get<Text>(TextHandle))
     {
-        pText->SetColor(Text::dInColor);
-        pText->SetCharacterSize(Text::dSize);
+        pText->SetColor(pEngine->DefaultText.InColor);
+        pText->SetCharacterSize(pEngine->DefaultText.Size);
         pText->SetPriority(0xFFFF); // [HACK]
         pText->SetWrap(Width);
         pText->Advance();
@@ -1652,9 +1994,9 @@ void NSBInterpreter::LockVideo()
 void NSBInterpreter::Save()
 {
     Npa::Buffer SaveData;
-    SaveData.Write<uint32_t>(VariableHolder.Cache.size());
+    SaveData.Write<uint32_t>(Variables.GetNames().size());
     vector<pair<string, Variable*> > Arrays;
-    for (auto& var : VariableHolder.Cache)
+    for (auto& var : Variables.GetNames())
     {
         if (var.first.front() == '#')
             continue;
@@ -1667,15 +2009,15 @@ void NSBInterpreter::Save()
         SaveData.WriteStr32(NpaFile::FromUtf8(var.second->IsString() ? var.second->ToString() : ""));
         SaveData.Write<bool>(0); // unk - maybe bool? 4?
         SaveData.WriteStr32(NpaFile::FromUtf8("")); // TODO: arrayref?
-        if (!var.second->Assoc.empty())
+        if (!var.second->GetKeys().empty())
             Arrays.push_back(var);
     }
     SaveData.Write<uint32_t>(Arrays.size());
     for (auto& arr : Arrays)
     {
         SaveData.WriteStr32(NpaFile::FromUtf8(arr.first));
-        SaveData.Write<uint32_t>(arr.second->Assoc.size());
-        for (auto& i : arr.second->Assoc)
+        SaveData.Write<uint32_t>(arr.second->GetKeys().size());
+        for (auto& i : arr.second->GetKeys())
             SaveData.WriteStr32(NpaFile::ToUtf8(i.first));
     }
     fs::WriteFile(PopSave(), NpaFile::Encrypt(SaveData.GetData(), SaveData.GetSize()), SaveData.GetSize());
@@ -1709,12 +2051,12 @@ void NSBInterpreter::ClearBacklog()
 
 void NSBInterpreter::SetFont()
 {
-    Text::dFont = PopString();
-    Text::dSize = PopInt();
-    Text::dInColor = PopColor();
-    Text::dOutColor = PopColor();
-    Text::dWeight = PopInt();
-    Text::dAlign = PopString();
+    pEngine->DefaultText.Font = PopString();
+    pEngine->DefaultText.Size = PopInt();
+    pEngine->DefaultText.InColor = PopColor();
+    pEngine->DefaultText.OutColor = PopColor();
+    pEngine->DefaultText.Weight = PopInt();
+    pEngine->DefaultText.Align = PopString();
 }
 
 void NSBInterpreter::SetShortcut()
@@ -1798,7 +2140,7 @@ void NSBInterpreter::SetBacklog()
     /*string Voice = */PopString();
 
     // [WORKAROUND] In JAST the third parameter may be an integer
-    Variable::Destroy(PopVar());
+    PopValue();
     ///*string Name = */PopString();
 }
 
@@ -1824,9 +2166,9 @@ void NSBInterpreter::CreateText()
 
 void NSBInterpreter::AtExpression()
 {
-    Variable* pVar = PopVar();
-    pVar->Relative = true;
-    PushVar(pVar);
+    Value Val = PopValue().Deref();
+    Val.Relative = true;
+    PushValue(Val);
 }
 
 void NSBInterpreter::Random()
@@ -1855,12 +2197,14 @@ void NSBInterpreter::DateTime()
 {
     time_t t = time(nullptr);
     tm* tms = localtime(&t);
-    PopVar()->Set(tms->tm_year + 1900);
-    PopVar()->Set(tms->tm_mon + 1);
-    PopVar()->Set(tms->tm_mday);
-    PopVar()->Set(tms->tm_hour);
-    PopVar()->Set(tms->tm_min);
-    PopVar()->Set(tms->tm_sec);
+    int32_t Values[] =
+    {
+        tms->tm_year + 1900, tms->tm_mon + 1, tms->tm_mday,
+        tms->tm_hour, tms->tm_min, tms->tm_sec
+    };
+    for (int32_t Val : Values)
+        if (Variable* pVar = PopVar())
+            pVar->Set(Val);
 }
 
 void NSBInterpreter::Shake()
@@ -1875,10 +2219,9 @@ void NSBInterpreter::Shake()
     /*int32_t Tempo = */PopTempo();
     bool Wait = PopBool();
 
-    ObjectHolder.Execute(Handle, [Time, XWidth, YWidth] (Object** ppObject)
+    ObjectHolder.ExecuteAs<Texture>(Handle, [Time, XWidth, YWidth] (Texture* pTexture)
     {
-        if (Texture* pTexture = dynamic_cast<Texture*>(*ppObject))
-            pTexture->Shake(XWidth, YWidth, Time);
+        pTexture->Shake(XWidth, YWidth, Time);
     });
 
     if (Wait)
@@ -1947,7 +2290,7 @@ void NSBInterpreter::Message()
 
 void NSBInterpreter::Integer()
 {
-    PushVar(PopVar());
+    PushValue(PopValue());
 }
 
 void NSBInterpreter::CreateScrollbar()
@@ -0,0 +1,78 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "Object.hpp"
+#include <algorithm>
+
+Object::~Object()
+{
+    pEngine->Objects.Remove(Handle);
+    {
+        lock_guard<mutex> Guard(pEngine->PostedLock);
+        if (Posted)
+            pEngine->Posted.erase(find(pEngine->Posted.begin(), pEngine->Posted.end(), this));
+    }
+    vector<ObjectListener*> Copy(Listeners);
+    for (ObjectListener* pListener : Copy)
+        pListener->OnDestroy(this);
+}
+
+void Object::Listen(ObjectListener* pListener)
+{
+    Listeners.push_back(pListener);
+}
+
+void Object::Unlisten(ObjectListener* pListener)
+{
+    auto iter = find(Listeners.begin(), Listeners.end(), pListener);
+    if (iter != Listeners.end())
+        Listeners.erase(iter);
+}
+
+void Object::Notify()
+{
+    // Listeners usually stop listening when notified
+    vector<ObjectListener*> Copy(Listeners);
+    for (ObjectListener* pListener : Copy)
+        pListener->OnAction(this);
+}
+
+void Object::Post()
+{
+    lock_guard<mutex> Guard(pEngine->PostedLock);
+    if (!Posted)
+    {
+        Posted = true;
+        pEngine->Posted.push_back(this);
+    }
+}
+
+void Object::DispatchPosted()
+{
+    vector<Object*> Objects;
+    {
+        lock_guard<mutex> Guard(sEngine->PostedLock);
+        if (sEngine->Posted.empty())
+            return;
+
+        Objects.swap(sEngine->Posted);
+        for (Object* pObject : Objects)
+            pObject->Posted = false;
+    }
+    for (Object* pObject : Objects)
+        pObject->Notify();
+}
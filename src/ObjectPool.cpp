@@ -0,0 +1,84 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "ObjectPool.hpp"
+#include <iostream>
+#include <new>
+
+ObjectPool::ObjectPool() : FreeLists(), NumLive(0)
+{
+}
+
+ObjectPool::~ObjectPool()
+{
+    // Objects still alive would be freed into released slabs later
+    if (NumLive)
+    {
+        cout << "Object pool destroyed with " << NumLive << " live objects, leaking its memory" << endl;
+        return;
+    }
+
+    for (char* pSlab : Slabs)
+        ::operator delete(pSlab);
+}
+
+void* ObjectPool::Allocate(size_t Size)
+{
+    if (Size > MAX_SIZE)
+        return ::operator new(Size);
+
+    size_t Class = (Size - 1) / GRANULARITY;
+    if (!FreeLists[Class])
+    {
+        size_t BlockSize = HEADER_SIZE + (Class + 1) * GRANULARITY;
+        char* pSlab = static_cast<char*>(::operator new(BlockSize * SLAB_OBJECTS));
+        Slabs.push_back(pSlab);
+        for (size_t i = 0; i < SLAB_OBJECTS; ++i)
+        {
+            char* pBlock = pSlab + i * BlockSize;
+            *reinterpret_cast<ObjectPool**>(pBlock) = this;
+            Release(pBlock, Class);
+        }
+    }
+
+    Node* pNode = FreeLists[Class];
+    FreeLists[Class] = pNode->pNext;
+    NumLive++;
+    return pNode;
+}
+
+void ObjectPool::Free(void* pMemory, size_t Size)
+{
+    if (!pMemory)
+        return;
+
+    if (Size > MAX_SIZE)
+        return ::operator delete(pMemory);
+
+    char* pBlock = static_cast<char*>(pMemory) - HEADER_SIZE;
+    ObjectPool* pPool = *reinterpret_cast<ObjectPool**>(pBlock);
+    pPool->Release(pBlock, (Size - 1) / GRANULARITY);
+    pPool->NumLive--;
+}
+
+// The list link goes after the header, which keeps the owning pool
+void ObjectPool::Release(void* pBlock, size_t Class)
+{
+    Node* pNode = reinterpret_cast<Node*>(static_cast<char*>(pBlock) + HEADER_SIZE);
+    pNode->pNext = FreeLists[Class];
+    FreeLists[Class] = pNode;
+}
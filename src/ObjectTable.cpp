@@ -0,0 +1,62 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "ObjectTable.hpp"
+#include <iostream>
+
+uint32_t ObjectTable::Add(Object* pObject)
+{
+    uint32_t Index;
+    if (!Free.empty())
+    {
+        Index = Free.back();
+        Free.pop_back();
+    }
+    else if (Slots.size() <= INDEX_MASK)
+    {
+        Index = Slots.size();
+        // Generation 0 is never used, so no handle is INVALID_HANDLE
+        Slots.push_back({nullptr, 1});
+    }
+    else
+    {
+        cout << "Object table is full" << endl;
+        return INVALID_HANDLE;
+    }
+
+    Slots[Index].pObject = pObject;
+    return Slots[Index].Generation << INDEX_BITS | Index;
+}
+
+void ObjectTable::Remove(uint32_t Handle)
+{
+    if (Get(Handle) == nullptr)
+        return;
+
+    uint32_t Index = Handle & INDEX_MASK;
+    Slot& Entry = Slots[Index];
+    Entry.pObject = nullptr;
+    // A wrapped generation would make old handles resolve again, so the slot is retired.
+    // Generation 0 matches no handle but INVALID_HANDLE, which resolves to nullptr anyway
+    if (Entry.Generation == MAX_GENERATION)
+    {
+        Entry.Generation = 0;
+        return;
+    }
+    Entry.Generation++;
+    Free.push_back(Index);
+}
@@ -19,11 +19,14 @@
 #include "nsbconstants.hpp"
 #include <gst/video/videooverlay.h>
 #include <thread>
+#include <mutex>
 
 GstBusSyncReply SyncHandler(GstBus* bus, GstMessage* msg, gpointer Handle)
 {
     if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS)
         ((Playable*)Handle)->OnEOS();
+    else if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+        ((Playable*)Handle)->OnError(msg);
     else
         return GST_BUS_PASS;
 
@@ -78,6 +81,7 @@ static void FeedData(GstElement* Pipeline, guint size, AppSrc* pAppsrc)
 
 AppSrc::AppSrc(Resource& Res) : Offset(0), File(Res)
 {
+    Playable::InitGStreamer();
     Appsrc = (GstAppSrc*)gst_element_factory_make("appsrc", nullptr);
     if (!Appsrc)
         cerr << "Failed to create appsrc" << endl;
@@ -91,11 +95,15 @@ AppSrc::AppSrc(Resource& Res) : Offset(0), File(Res)
 Playable::Playable(const string& FileName) :
 Appsrc(nullptr),
 Playing(false),
+Finished(true),
 Loop(false),
 AudioBin(nullptr),
 Begin(0),
 End(0)
 {
+    Types |= TYPE;
+    pPlayable = this;
+    InitGStreamer();
     GstElement* Filesrc = gst_element_factory_make("filesrc", nullptr);
     if (!Filesrc)
         cerr << "Failed to create filesrc" << endl;
@@ -106,9 +114,12 @@ End(0)
 
 Playable::Playable(Resource Res) :
 Appsrc(new AppSrc(Res)),
+Finished(true),
 Loop(false),
 Begin(0)
 {
+    Types |= TYPE;
+    pPlayable = this;
     InitPipeline((GstElement*)Appsrc->Appsrc);
     InitAudio();
 }
@@ -119,6 +130,13 @@ Playable::~Playable()
     gst_object_unref(GST_OBJECT(Pipeline));
 }
 
+// The registry scan takes long enough to be done off the engine thread
+void Playable::InitGStreamer()
+{
+    static once_flag Init;
+    call_once(Init, [] { gst_init(nullptr, nullptr); });
+}
+
 void Playable::InitPipeline(GstElement* Source)
 {
     Pipeline = gst_pipeline_new("pipeline");
@@ -201,15 +219,23 @@ void Playable::SetLoop(bool Loop)
 void Playable::Stop()
 {
     gst_element_set_state(Pipeline, GST_STATE_NULL);
+    Finished = true;
+    Post();
 }
 
 void Playable::Play()
 {
+    Finished = false;
     GstStateChangeReturn ret = gst_element_set_state(Pipeline, GST_STATE_PLAYING);
     if (ret == GST_STATE_CHANGE_ASYNC)
         ret = gst_element_get_state(Pipeline, nullptr, nullptr, GST_CLOCK_TIME_NONE);
     if (ret == GST_STATE_CHANGE_FAILURE)
+    {
         cerr << "Failed to set pipline state to PLAYING" << endl;
+        Finished = true;
+        Post();
+        return;
+    }
     gst_element_seek_simple(Pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH, Begin);
     ret = gst_element_get_state(Pipeline, nullptr, nullptr, GST_CLOCK_TIME_NONE);
     if (ret == GST_STATE_CHANGE_FAILURE)
@@ -239,6 +265,24 @@ void Playable::OnEOS()
 {
     if (Loop)
         thread([this](){Play();}).detach();
+    else
+    {
+        Finished = true;
+        Post();
+    }
+}
+
+// Called from the streaming thread, a broken stream ends like a finished one
+void Playable::OnError(GstMessage* Msg)
+{
+    GError* pError = nullptr;
+    gst_message_parse_error(Msg, &pError, nullptr);
+    cerr << "Playback error: " << (pError ? pError->message : "unknown") << endl;
+    if (pError)
+        g_error_free(pError);
+
+    Finished = true;
+    Post();
 }
 
 void Playable::Request(int32_t State)
@@ -261,8 +305,7 @@ void Playable::Request(int32_t State)
     }
 }
 
-// [HACK]
 bool Playable::Action()
 {
-    return RemainTime() <= 0;
+    return Finished;
 }
@@ -16,7 +16,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * */
 #include "ResourceMgr.hpp"
+#include "CompiledScript.hpp"
+#include "ScriptCache.hpp"
+#include "ArchiveIndex.hpp"
 #include "scriptfile.hpp"
+#include "nsbmagic.hpp"
+#include "Object.hpp"
 #include <glib.h>
 
 char* Resource::ReadData(uint32_t Offset, uint32_t Size)
@@ -24,34 +29,55 @@ char* Resource::ReadData(uint32_t Offset, uint32_t Size)
     return pArchive->ReadData(File, Offset, Size, g_malloc);
 }
 
-ResourceMgr* sResourceMgr;
+// Script loading is mostly decompression and parsing, a few workers are enough
+static const uint32_t MAX_WORKERS = 4;
 
-ResourceMgr::ResourceMgr()
+ResourceMgr::ResourceMgr() : Generation(1), pScriptCache(nullptr), pArchiveIndex(nullptr), NumDone(0), Stopping(false)
 {
 }
 
 ResourceMgr::~ResourceMgr()
 {
+    StopLoading();
+    delete pScriptCache;
+    delete pArchiveIndex;
     for_each(Archives.begin(), Archives.end(), default_delete<INpaFile>());
+    for (LazyArchive& Archive : LazyArchives)
+        delete Archive.pArchive;
 }
 
 Resource ResourceMgr::GetResource(string Path)
 {
     transform(Path.begin(), Path.end(), Path.begin(), ::tolower);
-    for (uint32_t i = 0; i < Archives.size(); ++i)
-    {
-        auto File = Archives[i]->FindFile(Path);
-        if (File != Archives[i]->End())
-            return Resource(Archives[i], File);
-    }
-    return Resource(nullptr, Archives[0]->End());
+    INpaFile::NpaIterator File;
+    INpaFile* pArchive = FindArchive(Path, File);
+    return Resource(pArchive, File);
 }
 
+// Script data CompileScript has already read on this thread, see there
+struct PendingRead
+{
+    string Path;
+    char* pData;
+    uint32_t Size;
+};
+static thread_local PendingRead sPendingRead;
+
 char* ResourceMgr::Read(string Path, uint32_t& Size)
 {
     transform(Path.begin(), Path.end(), Path.begin(), ::tolower);
-    for (uint32_t i = 0; i < Archives.size(); ++i)
-        if (char* pData = Archives[i]->ReadFile(Path, Size))
+    if (sPendingRead.pData && sPendingRead.Path == Path)
+    {
+        char* pData = sPendingRead.pData;
+        Size = sPendingRead.Size;
+        sPendingRead.pData = nullptr;
+        return pData;
+    }
+
+    lock_guard<mutex> Guard(ReadLock);
+    INpaFile::NpaIterator File;
+    if (INpaFile* pArchive = FindArchive(Path, File))
+        if (char* pData = pArchive->ReadFile(Path, Size))
             return pData;
 
     cout << "Failed to read " << Path << endl;
@@ -59,29 +85,415 @@ char* ResourceMgr::Read(string Path, uint32_t& Size)
     return nullptr;
 }
 
-ScriptFile* ResourceMgr::GetScriptFile(const string& Path)
+CompiledScript* ResourceMgr::GetScript(const string& Path)
 {
-    if (ScriptFile* pCache = CacheHolder.Read(Path))
+    if (CompiledScript* pCache = CacheHolder.Read(Path))
         return pCache;
 
-    ScriptFile* pScript = ReadScriptFile(Path);
-    if (!pScript)
+    // A worker is loading it already
+    bool Loading = false;
+    {
+        unique_lock<mutex> Guard(LoadLock);
+        Requested.insert(Path);
+        auto iter = Jobs.find(Path);
+        if ((Loading = iter != Jobs.end()))
+        {
+            DoneCond.wait(Guard, [&] { return iter->second.Done; });
+            // Poll adds it now
+            if (iter->second.Prefetch)
+            {
+                iter->second.Prefetch = false;
+                NumDone++;
+            }
+        }
+    }
+    if (Loading)
+    {
+        Poll();
+        return CacheHolder.Read(Path);
+    }
+
+    CompiledScript* pScript = CompileScript(Path);
+    if (pScript)
+    {
+        AddScript(Path, pScript);
+        Generation++;
+    }
+    return pScript;
+}
+
+void ResourceMgr::AddArchive(const string& Filename, function<INpaFile*(const string&)> Open)
+{
+    LazyArchives.push_back({Filename, Open, nullptr});
+    // Positions in the index no longer match
+    delete pArchiveIndex;
+    pArchiveIndex = nullptr;
+}
+
+/*
+ * Archives which were opened up front are searched first, then the added
+ * ones in order. With an index only the archive holding the file is
+ * opened, and a file missing from the index is in none of them since the
+ * archive stamps matched. Without an index, or if the indexed archive
+ * does not have the file after all, every added archive is opened until
+ * one has it.
+ * */
+INpaFile* ResourceMgr::FindArchive(const string& Path, INpaFile::NpaIterator& File)
+{
+    for (INpaFile* pArchive : Archives)
+        if ((File = pArchive->FindFile(Path)) != pArchive->End())
+            return pArchive;
+
+    if (pArchiveIndex)
+    {
+        ArchiveIndex::Entry Entry;
+        if (!pArchiveIndex->Find(Path, Entry))
+            return nullptr;
+        if (INpaFile* pArchive = GetArchive(Entry.Archive))
+            if ((File = pArchive->FindFile(Path)) != pArchive->End())
+                return pArchive;
+    }
+
+    for (uint32_t i = 0; i < LazyArchives.size(); ++i)
+        if (INpaFile* pArchive = GetArchive(i))
+            if ((File = pArchive->FindFile(Path)) != pArchive->End())
+                return pArchive;
+    return nullptr;
+}
+
+INpaFile* ResourceMgr::GetArchive(uint32_t Index)
+{
+    if (Index >= LazyArchives.size())
         return nullptr;
 
-    for (const string& i : pScript->GetIncludes())
-        GetScriptFile(i);
+    lock_guard<mutex> Guard(ArchiveLock);
+    LazyArchive& Archive = LazyArchives[Index];
+    if (Archive.Open)
+    {
+        Archive.pArchive = Archive.Open(Archive.Filename);
+        Archive.Open = nullptr;
+        if (!Archive.pArchive)
+            cout << "Failed to open archive " << Archive.Filename << endl;
+    }
+    return Archive.pArchive;
+}
 
-    CacheHolder.Write(Path, pScript);
+void ResourceMgr::OpenArchiveIndex(const string& Filename)
+{
+    delete pArchiveIndex;
+    pArchiveIndex = nullptr;
+
+    vector<ArchiveIndex::Stamp> Stamps(LazyArchives.size());
+    for (uint32_t i = 0; i < LazyArchives.size(); ++i)
+        if (!ArchiveIndex::GetStamp(LazyArchives[i].Filename, Stamps[i]))
+            return;
+
+    pArchiveIndex = new ArchiveIndex(Filename, Stamps);
+    if (pArchiveIndex->IsValid())
+        return;
+
+    delete pArchiveIndex;
+    pArchiveIndex = nullptr;
+
+    // Rebuilt from every archive, the first one holding a file wins
+    map<string, ArchiveIndex::Entry> Entries;
+    for (uint32_t i = 0; i < LazyArchives.size(); ++i)
+    {
+        INpaFile* pArchive = GetArchive(i);
+        if (!pArchive)
+            return;
+
+        // Keyed like the paths GetResource looks up
+        for (auto File = pArchive->Begin(); File != pArchive->End(); ++File)
+        {
+            string Path = pArchive->GetFileName(File);
+            transform(Path.begin(), Path.end(), Path.begin(), ::tolower);
+            Entries.insert(make_pair(Path, ArchiveIndex::Entry{i, pArchive->GetFileSize(File)}));
+        }
+    }
+
+    if (!ArchiveIndex::Write(Filename, Stamps, Entries))
+    {
+        cout << "Failed to write archive index " << Filename << endl;
+        return;
+    }
+
+    pArchiveIndex = new ArchiveIndex(Filename, Stamps);
+    if (!pArchiveIndex->IsValid())
+    {
+        delete pArchiveIndex;
+        pArchiveIndex = nullptr;
+    }
+}
+
+void ResourceMgr::OpenScriptCache(const string& Filename)
+{
+    StopLoading();
+    delete pScriptCache;
+    pScriptCache = new ScriptCache(Filename);
+    Stopping = false;
+}
+
+/*
+ * Archived data is hashed rather than trusting file names or timestamps,
+ * so a patched archive invalidates exactly the scripts that changed. On a
+ * miss the data which was hashed is handed to the Read of ReadScriptFile,
+ * so a script is read and decrypted once either way. May be called from
+ * worker threads.
+ * */
+CompiledScript* ResourceMgr::CompileScript(const string& Path)
+{
+    char* pData = nullptr;
+    uint32_t Size = 0;
+    // Scripts which are not archived under their own path are not cached
+    if (pScriptCache && GetResource(Path).IsValid())
+        pData = Read(Path, Size);
+
+    uint64_t Hash = 0;
+    bool Cached = pData;
+    if (Cached)
+    {
+        Hash = ScriptCache::HashData(pData, Size);
+        if (ScriptImage* pImage = pScriptCache->Load(Path, Hash))
+        {
+            delete[] pData;
+            return new CompiledScript(pImage);
+        }
+
+        sPendingRead = {Path, pData, Size};
+        transform(sPendingRead.Path.begin(), sPendingRead.Path.end(), sPendingRead.Path.begin(), ::tolower);
+    }
+
+    ScriptFile* pFile = ReadScriptFile(Path);
+    // Not read through Read after all
+    delete[] sPendingRead.pData;
+    sPendingRead.pData = nullptr;
+    if (!pFile)
+        return nullptr;
+
+    CompiledScript* pScript = new CompiledScript(pFile);
+    if (Cached)
+        pScriptCache->Store(Path, Hash, pScript);
     return pScript;
 }
 
-ScriptFile* ResourceMgr::ResolveSymbol(const string& Symbol, uint32_t& CodeLine)
+void ResourceMgr::AddScript(const string& Path, CompiledScript* pScript)
 {
-    for (auto& i : CacheHolder.Cache)
+    QueueIncludes(pScript);
+    CacheHolder.Write(Path, pScript);
+    IndexSymbols(pScript);
+}
+
+/*
+ * Scripts called by a thread are loaded by workers, so the engine thread
+ * keeps running (and drawing) while a new chapter is parsed. The calling
+ * thread waits on the returned object, which is deleted when the script
+ * has been added to the cache. Wait objects are only created and deleted
+ * here, in Poll and in StopLoading, on the engine thread; workers have no
+ * engine and never touch them.
+ * */
+Object* ResourceMgr::LoadScript(const string& Path)
+{
+    if (CacheHolder.Read(Path))
+        return nullptr;
+
     {
-        CodeLine = i.second->GetSymbol(Symbol);
-        if (CodeLine != NSB_INVALIDE_LINE)
-            return i.second;
+        lock_guard<mutex> Guard(LoadLock);
+        StartWorkers();
+        auto iter = Jobs.find(Path);
+        if (iter == Jobs.end())
+        {
+            // Failed to load before, GetScript reports it
+            if (Requested.count(Path))
+                return nullptr;
+            QueueLoad(Path, false);
+            iter = Jobs.find(Path);
+        }
+
+        LoadJob& Job = iter->second;
+        if (Job.Prefetch)
+        {
+            Job.Prefetch = false;
+            if (Job.Done)
+                NumDone++;
+        }
+        if (!Job.Done)
+        {
+            if (!Job.pWait)
+                Job.pWait = new Object;
+            return Job.pWait;
+        }
     }
+    Poll();
     return nullptr;
 }
+
+void ResourceMgr::Poll()
+{
+    if (!NumDone)
+        return;
+
+    vector<pair<string, LoadJob>> Finished;
+    {
+        lock_guard<mutex> Guard(LoadLock);
+        for (auto i = Jobs.begin(); i != Jobs.end();)
+        {
+            if (!i->second.Done || i->second.Prefetch)
+            {
+                ++i;
+                continue;
+            }
+            Finished.push_back(*i);
+            i = Jobs.erase(i);
+        }
+        NumDone = 0;
+    }
+
+    for (auto& i : Finished)
+    {
+        if (i.second.pScript)
+            AddScript(i.first, i.second.pScript);
+        delete i.second.pWait;
+    }
+    // Call site caches are flushed once for the whole batch
+    Generation++;
+}
+
+void ResourceMgr::StopLoading()
+{
+    {
+        lock_guard<mutex> Guard(LoadLock);
+        Stopping = true;
+    }
+    LoadCond.notify_all();
+    for (thread& Worker : Workers)
+        Worker.join();
+    Workers.clear();
+
+    for (auto& i : Jobs)
+    {
+        delete i.second.pScript;
+        delete i.second.pWait;
+    }
+    Jobs.clear();
+    LoadQueue.clear();
+}
+
+// LoadLock must be held
+void ResourceMgr::StartWorkers()
+{
+    if (!Workers.empty())
+        return;
+
+    uint32_t NumWorkers = min(max(thread::hardware_concurrency(), 1u), MAX_WORKERS);
+    for (uint32_t i = 0; i < NumWorkers; ++i)
+        Workers.emplace_back(&ResourceMgr::WorkerMain, this);
+}
+
+// LoadLock must be held
+void ResourceMgr::QueueLoad(const string& Path, bool Prefetch)
+{
+    if (!Requested.insert(Path).second)
+        return;
+
+    Jobs[Path] = {nullptr, nullptr, false, Prefetch};
+    LoadQueue.push_back(Path);
+    LoadCond.notify_one();
+}
+
+void ResourceMgr::WorkerMain()
+{
+    unique_lock<mutex> Guard(LoadLock);
+    while (true)
+    {
+        LoadCond.wait(Guard, [this] { return Stopping || !LoadQueue.empty(); });
+        if (Stopping)
+            return;
+
+        string Path = LoadQueue.front();
+        LoadQueue.pop_front();
+        Guard.unlock();
+
+        CompiledScript* pScript = CompileScript(Path);
+
+        Guard.lock();
+        LoadJob& Job = Jobs[Path];
+        Job.pScript = pScript;
+        Job.Done = true;
+        if (!Job.Prefetch)
+            NumDone++;
+        DoneCond.notify_all();
+    }
+}
+
+void ResourceMgr::QueueIncludes(CompiledScript* pScript)
+{
+    lock_guard<mutex> Guard(LoadLock);
+    for (const string& i : pScript->GetIncludes())
+    {
+        if (CacheHolder.Read(i))
+            continue;
+
+        PendingIncludes.push_back(i);
+        if (!Stopping)
+        {
+            StartWorkers();
+            QueueLoad(i, true);
+        }
+    }
+}
+
+/*
+ * Look the function up in the scripts added so far, then add pending
+ * includes (breadth first) until one of them defines it. The includes of
+ * every added script are parsed ahead by the workers, so this usually
+ * only waits for a worker which is still busy with it. Parsed includes
+ * are not indexed and do not flush call site caches until they are
+ * needed here, and their own includes are only queued from then on.
+ * */
+CompiledScript* ResourceMgr::ResolveSymbol(const string& Name, uint32_t& CodeLine)
+{
+    auto iter = Symbols.find(Name);
+    while (iter == Symbols.end() && !PendingIncludes.empty())
+    {
+        string Path = PendingIncludes.front();
+        PendingIncludes.pop_front();
+        if (!CacheHolder.Read(Path) && GetScript(Path))
+            iter = Symbols.find(Name);
+    }
+
+    if (iter == Symbols.end())
+    {
+        CodeLine = NSB_INVALIDE_LINE;
+        return nullptr;
+    }
+    CodeLine = iter->second.CodeLine;
+    return iter->second.pScript;
+}
+
+/*
+ * Function symbols are found through their declarations, and only kept if
+ * the script's own symbol table agrees. When several scripts define the
+ * same function, the first one by path wins as it did when every cached
+ * script was searched in order.
+ * */
+void ResourceMgr::IndexSymbols(CompiledScript* pScript)
+{
+    static const string Prefix = "function.";
+    for (uint32_t i = 0; Instruction* pInstr = pScript->GetInstruction(i); ++i)
+    {
+        if (pInstr->Magic != MAGIC_FUNCTION_DECLARATION || !pInstr->NumParams)
+            continue;
+
+        const string& Declared = pInstr->pLine->Params[0];
+        string Name = Declared.compare(0, Prefix.size(), Prefix) ? Prefix + Declared : Declared;
+        uint32_t CodeLine = pScript->GetSymbol(Name);
+        if (CodeLine == NSB_INVALIDE_LINE)
+            continue;
+
+        auto Result = Symbols.emplace(Name, Symbol{pScript, CodeLine});
+        Symbol& Existing = Result.first->second;
+        if (!Result.second && pScript->GetName() < Existing.pScript->GetName())
+            Existing = {pScript, CodeLine};
+    }
+}
@@ -0,0 +1,197 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "Scheduler.hpp"
+#include "NSBContext.hpp"
+#include "EngineContext.hpp"
+#include <vector>
+
+// Waits longer than this are infinite (negative script times)
+static const uint64_t MAX_WAIT = INT32_MAX;
+
+Scheduler::Scheduler() : Now(0), pRunning(nullptr), RunningRemoved(false)
+{
+}
+
+Scheduler::~Scheduler()
+{
+    for (auto i = Waiters.begin(); i != Waiters.end(); i = Waiters.upper_bound(i->first))
+        i->first->Unlisten(this);
+}
+
+void Scheduler::Add(NSBContext* pContext)
+{
+    NSBContext::SchedulerEntry& Entry = pContext->Sched;
+    Entry = NSBContext::SchedulerEntry();
+    Entry.Thread = Threads.insert(Threads.end(), pContext);
+    Entry.InThreads = true;
+
+    if (pContext->IsSleeping())
+        Suspend(pContext);
+    else
+        Requeue(pContext);
+}
+
+void Scheduler::Remove(NSBContext* pContext)
+{
+    NSBContext::SchedulerEntry& Entry = pContext->Sched;
+    if (!Entry.InThreads)
+        return;
+
+    if (pContext == pRunning)
+    {
+        pRunning = nullptr;
+        RunningRemoved = true;
+    }
+
+    Unlink(pContext);
+    Threads.erase(Entry.Thread);
+    Entry.InThreads = false;
+}
+
+void Scheduler::Unlink(NSBContext* pContext)
+{
+    NSBContext::SchedulerEntry& Entry = pContext->Sched;
+    if (Entry.InReady)
+        Ready.erase(Entry.Ready);
+    if (Entry.InWait)
+    {
+        Object* pObject = Entry.Wait->first;
+        Waiters.erase(Entry.Wait);
+        if (Waiters.find(pObject) == Waiters.end())
+            pObject->Unlisten(this);
+    }
+    if (Entry.InClick)
+        ClickWaiters.erase(Entry.Click);
+    if (Entry.InTimer)
+        Timers.erase(Entry.Timer);
+    Entry.InReady = Entry.InWait = Entry.InClick = Entry.InTimer = false;
+}
+
+void Scheduler::Suspend(NSBContext* pContext)
+{
+    NSBContext::SchedulerEntry& Entry = pContext->Sched;
+    if (pContext == pRunning)
+        pRunning = nullptr;
+
+    Unlink(pContext);
+    if (pContext->ObjectHandle)
+    {
+        Object* pObject = pContext->GetWaitObject();
+        // Deleted or finished before the wait started
+        if (!pObject || pObject->Action())
+        {
+            Wake(pContext);
+            return;
+        }
+
+        if (Waiters.find(pObject) == Waiters.end())
+            pObject->Listen(this);
+        Entry.Wait = Waiters.emplace(pObject, pContext);
+        Entry.InWait = true;
+    }
+    if (pContext->TextHandle || pContext->WaitInterrupt)
+    {
+        // The game waits for the player for the first time
+        sEngine->Timeline.MarkInteractive();
+        Entry.Click = ClickWaiters.insert(ClickWaiters.end(), pContext);
+        Entry.InClick = true;
+    }
+    // Text waits only end on click
+    if (!pContext->TextHandle && pContext->WaitTime <= MAX_WAIT)
+    {
+        Entry.Timer = Timers.emplace(Now + pContext->WaitTime, pContext);
+        Entry.InTimer = true;
+    }
+}
+
+void Scheduler::Wake(NSBContext* pContext)
+{
+    pContext->Wake();
+    if (pContext != pRunning && pContext->Sched.InThreads)
+        Requeue(pContext);
+}
+
+NSBContext* Scheduler::Pop()
+{
+    if (Ready.empty())
+        return nullptr;
+
+    pRunning = Ready.front();
+    pRunning->Sched.InReady = false;
+    Ready.pop_front();
+    RunningRemoved = false;
+    return pRunning;
+}
+
+void Scheduler::Requeue(NSBContext* pContext)
+{
+    NSBContext::SchedulerEntry& Entry = pContext->Sched;
+    if (pContext == pRunning)
+        pRunning = nullptr;
+
+    Unlink(pContext);
+    Entry.Ready = Ready.insert(Ready.end(), pContext);
+    Entry.InReady = true;
+}
+
+void Scheduler::Update(uint32_t Diff)
+{
+    Now += Diff;
+    while (!Timers.empty() && Timers.begin()->first <= Now)
+        Wake(Timers.begin()->second);
+}
+
+// Deliver notifications posted by objects from other threads (Playable EOS)
+void Scheduler::Poll()
+{
+    Object::DispatchPosted();
+}
+
+void Scheduler::OnClick()
+{
+    for (auto i = ClickWaiters.begin(); i != ClickWaiters.end();)
+    {
+        NSBContext* pContext = *i++;
+        pContext->OnClick();
+        if (!pContext->IsSleeping())
+            Wake(pContext);
+    }
+}
+
+// Objects also notify when only one of their actions ended, e.g. a fade of a movie
+void Scheduler::OnAction(Object* pObject)
+{
+    if (pObject->Action())
+        WakeWaiters(pObject);
+}
+
+void Scheduler::OnDestroy(Object* pObject)
+{
+    WakeWaiters(pObject);
+}
+
+void Scheduler::WakeWaiters(Object* pObject)
+{
+    vector<NSBContext*> Woken;
+    auto Range = Waiters.equal_range(pObject);
+    for (auto i = Range.first; i != Range.second; ++i)
+        Woken.push_back(i->second);
+
+    for (NSBContext* pContext : Woken)
+        Wake(pContext);
+}
@@ -0,0 +1,326 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "ScriptCache.hpp"
+#include "CompiledScript.hpp"
+#include "npengineversion.hpp"
+#include "scriptfile.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Bump when the entry layout or the meaning of a line changes
+static const uint32_t FORMAT_VERSION = 1;
+static const char MAGIC[4] = { 'N', 'P', 'S', 'C' };
+
+/*
+ * Values are stored in host byte order: the cache is only ever read by the
+ * machine that wrote it. Every read is bounds checked, a truncated or
+ * corrupted file fails the read instead of crashing.
+ * */
+struct CacheReader
+{
+    CacheReader(const char* pData, size_t Size) : p(pData), pEnd(pData + Size), Ok(true) { }
+
+    template <class T>
+    T Read()
+    {
+        T Value = T();
+        if (!Ok || size_t(pEnd - p) < sizeof(T))
+            Ok = false;
+        else
+        {
+            memcpy(&Value, p, sizeof(T));
+            p += sizeof(T);
+        }
+        return Value;
+    }
+
+    string ReadString()
+    {
+        uint32_t Length = Read<uint32_t>();
+        if (!Ok || size_t(pEnd - p) < Length)
+        {
+            Ok = false;
+            return string();
+        }
+        string String(p, Length);
+        p += Length;
+        return String;
+    }
+
+    const char* p;
+    const char* pEnd;
+    bool Ok;
+};
+
+template <class T>
+static void Write(string& Out, T Value)
+{
+    Out.append((const char*)&Value, sizeof(T));
+}
+
+static void WriteString(string& Out, const string& String)
+{
+    Write<uint32_t>(Out, String.size());
+    Out += String;
+}
+
+ScriptCache::ScriptCache(const string& Filename) : Filename(Filename), pData(nullptr), Size(0)
+{
+    if (!Map())
+        Entries.clear();
+}
+
+ScriptCache::~ScriptCache()
+{
+    if (!Stored.empty() && !Save())
+        cout << "Failed to write script cache " << Filename << endl;
+
+    if (pData)
+        munmap((void*)pData, Size);
+}
+
+bool ScriptCache::Map()
+{
+    int fd = open(Filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat Stat;
+    if (fstat(fd, &Stat) == 0 && Stat.st_size > 0)
+    {
+        void* pMap = mmap(nullptr, Stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pMap != MAP_FAILED)
+        {
+            pData = (const char*)pMap;
+            Size = Stat.st_size;
+        }
+    }
+    close(fd);
+    if (!pData)
+        return false;
+
+    CacheReader Reader(pData, Size);
+    char Magic[sizeof(MAGIC)];
+    for (char& c : Magic)
+        c = Reader.Read<char>();
+    if (memcmp(Magic, MAGIC, sizeof(MAGIC)) ||
+        Reader.Read<uint32_t>() != FORMAT_VERSION ||
+        Reader.ReadString() != NPENGINE_VERSION)
+        return false;
+
+    uint32_t NumEntries = Reader.Read<uint32_t>();
+    for (uint32_t i = 0; i < NumEntries && Reader.Ok; ++i)
+    {
+        string Path = Reader.ReadString();
+        Entry& Ent = Entries[Path];
+        Ent.Hash = Reader.Read<uint64_t>();
+        Ent.Offset = Reader.Read<uint64_t>();
+        Ent.Length = Reader.Read<uint64_t>();
+        if (Ent.Offset > Size || Ent.Length > Size - Ent.Offset)
+            Reader.Ok = false;
+    }
+    return Reader.Ok;
+}
+
+ScriptImage* ScriptCache::Load(const string& Path, uint64_t Hash)
+{
+    auto iter = Entries.find(Path);
+    if (iter == Entries.end() || iter->second.Hash != Hash)
+        return nullptr;
+
+    CacheReader Reader(pData + iter->second.Offset, iter->second.Length);
+    ScriptImage* pImage = new ScriptImage;
+    pImage->Name = Reader.ReadString();
+    uint32_t NumIncludes = Reader.Read<uint32_t>();
+    for (uint32_t i = 0; i < NumIncludes && Reader.Ok; ++i)
+        pImage->Includes.push_back(Reader.ReadString());
+
+    uint32_t NumSymbols = Reader.Read<uint32_t>();
+    for (uint32_t i = 0; i < NumSymbols && Reader.Ok; ++i)
+    {
+        string Name = Reader.ReadString();
+        pImage->Symbols[Name] = Reader.Read<uint32_t>();
+    }
+
+    uint32_t FirstLine = Reader.Read<uint32_t>();
+    uint32_t NumLines = Reader.Read<uint32_t>();
+    if (Reader.Ok && FirstLine <= 1 && NumLines <= size_t(Reader.pEnd - Reader.p))
+        pImage->Lines.assign(FirstLine, nullptr);
+    else
+        Reader.Ok = false;
+
+    for (uint32_t i = 0; i < NumLines && Reader.Ok; ++i)
+    {
+        Line* pLine = new Line(Reader.Read<uint16_t>());
+        pImage->Lines.push_back(pLine);
+        uint32_t NumParams = Reader.Read<uint32_t>();
+        for (uint32_t j = 0; j < NumParams && Reader.Ok; ++j)
+            pLine->Params.push_back(Reader.ReadString());
+    }
+
+    if (!Reader.Ok || Reader.p != Reader.pEnd)
+    {
+        cout << "Ignoring corrupted script cache entry " << Path << endl;
+        delete pImage;
+        return nullptr;
+    }
+    return pImage;
+}
+
+/*
+ * The script file has no way to list its symbols, so every name a script
+ * can be entered by is looked up: each parameter as a label, and with the
+ * prefixes of functions, scenes and chapters for declarations.
+ * */
+void ScriptCache::Store(const string& Path, uint64_t Hash, CompiledScript* pScript)
+{
+    static const string Prefixes[] = { "function.", "scene.", "chapter." };
+
+    map<string, uint32_t> Symbols;
+    auto Probe = [&] (const string& Name)
+    {
+        if (Symbols.count(Name))
+            return;
+        uint32_t CodeLine = pScript->GetSymbol(Name);
+        if (CodeLine != NSB_INVALIDE_LINE)
+            Symbols[Name] = CodeLine;
+    };
+
+    uint32_t FirstLine = 0;
+    Instruction* pFirst = pScript->GetInstruction(0);
+    if (pFirst && !pFirst->pLine)
+        FirstLine = 1;
+
+    string Lines;
+    uint32_t NumLines = 0;
+    for (uint32_t i = FirstLine; Instruction* pInstr = pScript->GetInstruction(i); ++i, ++NumLines)
+    {
+        Line* pLine = pInstr->pLine;
+        Write<uint16_t>(Lines, pLine->Magic);
+        Write<uint32_t>(Lines, pLine->Params.size());
+        for (const string& Param : pLine->Params)
+        {
+            WriteString(Lines, Param);
+            Probe(Param);
+            for (const string& Prefix : Prefixes)
+                if (Param.compare(0, Prefix.size(), Prefix))
+                    Probe(Prefix + Param);
+        }
+    }
+
+    string Blob;
+    WriteString(Blob, pScript->GetName());
+    const vector<string>& Includes = pScript->GetIncludes();
+    Write<uint32_t>(Blob, Includes.size());
+    for (const string& Include : Includes)
+        WriteString(Blob, Include);
+
+    Write<uint32_t>(Blob, Symbols.size());
+    for (auto& i : Symbols)
+    {
+        WriteString(Blob, i.first);
+        Write<uint32_t>(Blob, i.second);
+    }
+
+    Write<uint32_t>(Blob, FirstLine);
+    Write<uint32_t>(Blob, NumLines);
+    Blob += Lines;
+
+    lock_guard<mutex> Guard(Lock);
+    Stored[Path] = make_pair(Hash, move(Blob));
+}
+
+// Entries of the old file which were not replaced are carried over
+bool ScriptCache::Save()
+{
+    string Header, Contents;
+    Header.append(MAGIC, sizeof(MAGIC));
+    Write<uint32_t>(Header, FORMAT_VERSION);
+    WriteString(Header, NPENGINE_VERSION);
+
+    uint32_t NumEntries = Stored.size();
+    for (auto& i : Entries)
+        if (!Stored.count(i.first))
+            NumEntries++;
+    Write<uint32_t>(Header, NumEntries);
+
+    vector<pair<const char*, size_t>> Blobs;
+    vector<size_t> OffsetPositions;
+    auto AddEntry = [&] (const string& Path, uint64_t Hash, const char* pBlob, size_t Length)
+    {
+        WriteString(Contents, Path);
+        Write<uint64_t>(Contents, Hash);
+        // Filled in once the size of the table is known
+        OffsetPositions.push_back(Contents.size());
+        Write<uint64_t>(Contents, 0);
+        Write<uint64_t>(Contents, Length);
+        Blobs.push_back(make_pair(pBlob, Length));
+    };
+
+    for (auto& i : Entries)
+        if (!Stored.count(i.first))
+            AddEntry(i.first, i.second.Hash, pData + i.second.Offset, i.second.Length);
+    for (auto& i : Stored)
+        AddEntry(i.first, i.second.first, i.second.second.data(), i.second.second.size());
+
+    uint64_t Offset = Header.size() + Contents.size();
+    for (size_t i = 0; i < Blobs.size(); ++i)
+    {
+        memcpy(&Contents[OffsetPositions[i]], &Offset, sizeof(Offset));
+        Offset += Blobs[i].second;
+    }
+
+    // Unique, engines in one process may save the same cache at once
+    string TempFilename = Filename + ".XXXXXX";
+    int fd = mkstemp(&TempFilename[0]);
+    if (fd == -1)
+        return false;
+    close(fd);
+
+    ofstream File(TempFilename, ios::binary | ios::trunc);
+    File.write(Header.data(), Header.size());
+    File.write(Contents.data(), Contents.size());
+    for (auto& Blob : Blobs)
+        File.write(Blob.first, Blob.second);
+    File.close();
+
+    if (!File)
+    {
+        remove(TempFilename.c_str());
+        return false;
+    }
+    return rename(TempFilename.c_str(), Filename.c_str()) == 0;
+}
+
+// FNV-1a
+uint64_t ScriptCache::HashData(const char* pData, uint32_t Size)
+{
+    uint64_t Hash = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < Size; ++i)
+    {
+        Hash ^= (uint8_t)pData[i];
+        Hash *= 1099511628211ULL;
+    }
+    return Hash;
+}
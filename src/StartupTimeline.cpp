@@ -0,0 +1,54 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "StartupTimeline.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+
+StartupTimeline::StartupTimeline() :
+Start(chrono::steady_clock::now()),
+Print(getenv("NPENGINE_TIMELINE")),
+Done(false)
+{
+}
+
+void StartupTimeline::Mark(const string& Name)
+{
+    if (Done)
+        return;
+
+    chrono::duration<double, milli> Time = chrono::steady_clock::now() - Start;
+    lock_guard<mutex> Guard(Lock);
+    double Previous = Phases.empty() ? 0.0 : Phases.back().Time;
+    Phases.push_back({Name, Time.count()});
+    if (Print)
+        cout << "startup: " << Name << " " << fixed << setprecision(2) << Time.count()
+             << " ms (+" << Time.count() - Previous << " ms)" << defaultfloat << endl;
+}
+
+void StartupTimeline::Finish()
+{
+    Mark("interactive");
+    Done = true;
+}
+
+vector<StartupTimeline::Phase> StartupTimeline::GetPhases()
+{
+    lock_guard<mutex> Guard(Lock);
+    return Phases;
+}
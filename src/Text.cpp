@@ -22,42 +22,17 @@
 #define yy_delete_buffer xml_delete_buffer
 #include "flex.hpp"
 #include <pango/pangocairo.h>
+#include <mutex>
 
-// For use in bison
-TextParser::Text* pText;
+// Defined in parser.y, builds the lines of the text passed to it
+int yyparse(TextParser::Text* pText);
 
-string Text::dFont;
-int32_t Text::dSize;
-uint32_t Text::dInColor;
-uint32_t Text::dOutColor;
-int32_t Text::dWeight;
-string Text::dAlign;
+// The flex scanner is not reentrant, engines on other threads take turns
+static mutex sParserLock;
 
-class VoiceMgr
-{
-public:
-    VoiceMgr() : pVoice(nullptr)
-    {
-    }
-
-    ~VoiceMgr()
-    {
-        delete pVoice;
-    }
-
-    void SetVoice(const string& Filename)
-    {
-        delete pVoice;
-        pVoice = new Playable(sResourceMgr->GetResource(Filename + ".ogg"));
-        pVoice->Play();
-    }
-
-private:
-    Playable* pVoice;
-} sVoiceMgr;
-
-Text::Text() : Index(0), LayoutWidth(-1), Size(dSize), Color(dInColor)
+Text::Text() : Index(0), LayoutWidth(-1), Size(pEngine->DefaultText.Size), Color(pEngine->DefaultText.InColor)
 {
+    Types |= TYPE;
 }
 
 Text::~Text()
@@ -66,9 +41,9 @@ Text::~Text()
 
 void Text::CreateFromXML(const string& XML)
 {
-    ::pText = this;
+    lock_guard<mutex> Guard(sParserLock);
     YY_BUFFER_STATE buffer = yy_scan_bytes(XML.c_str(), XML.size());
-    yyparse();
+    yyparse(this);
     yy_delete_buffer(buffer);
 }
 
@@ -106,8 +81,9 @@ bool Text::Advance()
     SetString(String);
 
     if (!CurrLine.VoiceAttrs.empty())
-        sVoiceMgr.SetVoice(CurrLine.VoiceAttrs[TextParser::ATTR_SRC]);
-    Index++;
+        pEngine->PlayVoice(CurrLine.VoiceAttrs[TextParser::ATTR_SRC]);
+    if (++Index == Lines.size())
+        Notify();
     return true;
 }
 
@@ -147,3 +123,9 @@ void Text::SetString(const string& String)
 void Text::Request(int32_t State)
 {
 }
+
+// Last line is shown
+bool Text::Action()
+{
+    return Index == Lines.size();
+}
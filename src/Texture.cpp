@@ -32,11 +32,12 @@ Angle(0),
 XScale(1000), YScale(1000),
 XShake(0), YShake(0), ShakeTime(0), ShakeTick(false)
 {
+    Types |= TYPE;
 }
 
 Texture::~Texture()
 {
-    pWindow->RemoveTexture(this);
+    pEngine->pWindow->RemoveTexture(this);
     delete pMove;
     delete pZoom;
     delete pFade;
@@ -53,10 +54,10 @@ void Texture::Request(int32_t State)
             SetSmoothing(true);
             break;
         case Nsb::ERASE:
-            pWindow->RemoveTexture(this);
+            pEngine->pWindow->RemoveTexture(this);
             break;
         case Nsb::ENTER:
-            pWindow->AddTexture(this);
+            pEngine->pWindow->AddTexture(this);
             break;
     }
 }
@@ -167,12 +168,28 @@ void Texture::Shake(int32_t XWidth, int32_t YWidth, int32_t Time)
 
 void Texture::UpdateEffects(uint32_t Diff)
 {
+    bool Animating = IsAnimating();
     if (pMove) pMove->OnDraw(this, Diff);
     if (pRotate) pRotate->OnDraw(this, Diff);
     if (pZoom) pZoom->OnDraw(this, Diff);
     if (pFade) pFade->OnDraw(Diff);
     if (pMask) pMask->OnDraw(Diff);
     if (pTone) pTone->OnDraw();
+
+    // Wake threads waiting for the effects to finish
+    if (Animating && !IsAnimating())
+        Notify();
+}
+
+bool Texture::IsAnimating()
+{
+    auto Busy = [] (LerpEffect* pEffect) { return pEffect && !pEffect->IsDone(); };
+    return Busy(pMove) || Busy(pRotate) || Busy(pZoom) || Busy(pFade) || Busy(pMask);
+}
+
+bool Texture::Action()
+{
+    return !IsAnimating();
 }
 
 void Texture::Draw(uint32_t Diff)
@@ -16,188 +16,371 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * */
 #include "Variable.hpp"
-#include "nsbconstants.hpp"
-#include <cassert>
+#include "ConstantCache.hpp"
+#include <cstdlib>
 
-Variable::Variable() : Literal(true), Relative(false)
-{
-}
+atomic<uint32_t> Variable::NextHook(0);
 
-Variable::~Variable()
+Value Value::MakeNull()
 {
+    Value Val;
+    Val.Tag = NSB_NULL;
+    Val.Relative = false;
+    Val.Int = 0;
+    return Val;
 }
 
-void Variable::Set(int32_t Int)
+Value Value::MakeInt(int32_t Int)
 {
+    Value Val;
+    Val.Tag = NSB_INT;
+    Val.Relative = false;
     Val.Int = Int;
-    Val.Str = "";
-    Tag = NSB_INT;
+    return Val;
 }
 
-void Variable::Set(float Float)
+Value Value::MakeFloat(float Float)
 {
+    Value Val;
+    Val.Tag = NSB_FLOAT;
+    Val.Relative = false;
     Val.Float = Float;
-    Val.Str = "";
-    Tag = NSB_FLOAT;
+    return Val;
 }
 
-void Variable::Set(const string& Str)
+Value Value::MakeString(const string* pStr, uint32_t Id)
+{
+    Value Val;
+    Val.Tag = NSB_STRING;
+    Val.Relative = IsRelative(*pStr);
+    Val.Id = Id;
+    Val.pStr = pStr;
+    return Val;
+}
+
+Value Value::MakeVariable(Variable* pVar)
+{
+    Value Val;
+    Val.Tag = NSB_VARIABLE;
+    Val.Relative = false;
+    Val.pVar = pVar;
+    return Val;
+}
+
+bool Value::IsRelative(const string& Str)
 {
-    Val.Str = Str;
     // hack
-    if (Str[0] == '@')
+    if (Str.empty() || Str[0] != '@')
+        return false;
+
+    char* pEnd;
+    strtol(Str.c_str() + 1, &pEnd, 10);
+    return pEnd != Str.c_str() + 1;
+}
+
+const Value& Value::Deref() const
+{
+    return Tag == NSB_VARIABLE ? pVar->Val : *this;
+}
+
+const string* Value::GetString() const
+{
+    const Value& Val = Deref();
+    return Val.Tag == NSB_STRING ? Val.pStr : nullptr;
+}
+
+int Value::GetTag() const
+{
+    return Deref().Tag;
+}
+
+float Value::ToFloat() const
+{
+    const Value& Val = Deref();
+    if (Val.Tag == NSB_FLOAT)
+        return Val.Float;
+    if (Val.Tag == NSB_INT)
+        return Val.Int;
+    return 0.0f;
+}
+
+int32_t Value::ToInt() const
+{
+    const Value& Val = Deref();
+    switch (Val.Tag)
     {
-        Relative = true;
-        try
+        case NSB_INT:
+            return Val.Int;
+        case NSB_FLOAT:
+            return Val.Float;
+        case NSB_STRING:
         {
-            stoi(Val.Str.c_str() + 1);
-        }
-        catch(...)
-        {
-            Relative = false;
+            int32_t Bool = BooleanCache::Get(Val);
+            if (Bool != -1)
+                return Bool;
+            return Val.Relative ? strtol(Val.pStr->c_str() + 1, nullptr, 10) : 0;
         }
     }
-    Tag = NSB_STRING;
+    return 0;
 }
 
-void Variable::Initialize()
+string Value::ToString() const
 {
-    Tag = NSB_NULL;
+    string Str;
+    AppendTo(Str);
+    return Str;
 }
 
-void Variable::Initialize(Variable* pVar)
+void Value::AppendTo(string& Str) const
 {
-    if (pVar->Tag == NSB_NULL)
-        Initialize();
-    else if (pVar->IsString())
-        Set(pVar->ToString());
-    else
-        Set(pVar->ToInt());
+    const Value& Val = Deref();
+    if (Val.Tag == NSB_STRING)
+        Str += *Val.pStr;
+    else if (Val.Tag == NSB_INT)
+    {
+        if (Val.Relative)
+            Str += '@';
+        Str += to_string(Val.Int);
+    }
 }
 
-Variable* Variable::MakeFloat(float Float)
+bool Value::IsFloat() const
 {
-    Variable* pVar = new Variable;
-    pVar->Set(Float);
-    return pVar;
+    return Deref().Tag == NSB_FLOAT;
 }
 
-Variable* Variable::MakeInt(int32_t Int)
+bool Value::IsInt() const
 {
-    Variable* pVar = new Variable;
-    pVar->Set(Int);
-    return pVar;
+    const Value& Val = Deref();
+    return Val.Tag == NSB_INT || Val.Tag == NSB_NULL || Val.Relative || (Val.Tag == NSB_STRING && BooleanCache::Get(Val) != -1);
 }
 
-Variable* Variable::MakeString(const string& Str)
+bool Value::IsString() const
 {
-    Variable* pVar = new Variable;
-    pVar->Set(Str);
-    return pVar;
+    const Value& Val = Deref();
+    return Val.Tag == NSB_STRING || Val.Tag == NSB_NULL || Val.Relative;
 }
 
-Variable* Variable::MakeNull(const string& Name)
+bool Value::IsNull() const
 {
-    Variable* pVar = new Variable;
-    pVar->Literal = false;
-    pVar->Name = Name;
-    pVar->Initialize();
-    return pVar;
+    return Deref().Tag == NSB_NULL;
 }
 
-Variable* Variable::MakeCopy(Variable* pVar, const string& Name)
+bool Value::IsRelative() const
 {
-    Variable* pNew = new Variable;
-    pNew->Literal = false;
-    pNew->Name = Name;
-    pNew->Initialize(pVar);
-    Variable::Destroy(pVar);
-    return pNew;
+    return Deref().Relative;
 }
 
-int Variable::GetTag()
+Variable::Variable(const string& Name) : Name(Name), Val(Value::MakeNull()), pArray(nullptr), pHooks(nullptr)
 {
-    return Tag;
 }
 
-float Variable::ToFloat()
+Variable::~Variable()
 {
-    return Val.Float;
+    delete pArray;
+    delete pHooks;
 }
 
-int32_t Variable::ToInt()
+uint32_t Variable::AddHook(VariableHook Hook)
 {
-    if (Tag == NSB_NULL)
-        return 0;
+    if (!pHooks)
+        pHooks = new map<uint32_t, VariableHook>;
+    uint32_t Id = NextHook++;
+    pHooks->emplace(Id, Hook);
+    return Id;
+}
+
+void Variable::RemoveHook(uint32_t Hook)
+{
+    if (!pHooks)
+        return;
 
-    if (Tag == NSB_STRING)
+    pHooks->erase(Hook);
+    if (pHooks->empty())
     {
-        int32_t Value = Nsb::ConstantToValue<Nsb::Boolean>(ToString());
-        if (Value != -1)
-            return Value;
-        return Relative ? stoi(Val.Str.c_str() + 1) : 0;
+        delete pHooks;
+        pHooks = nullptr;
     }
+}
 
-    return Val.Int;
+void Variable::RunHooks()
+{
+    // Hooks may remove themselves
+    map<uint32_t, VariableHook> Hooks(*pHooks);
+    for (auto& Hook : Hooks)
+        Hook.second(this);
 }
 
-string Variable::ToString()
+void Variable::Set(int32_t Int)
+{
+    Val = Value::MakeInt(Int);
+    Str.clear();
+    Changed();
+}
+
+void Variable::Set(float Float)
+{
+    Val = Value::MakeFloat(Float);
+    Str.clear();
+    Changed();
+}
+
+void Variable::Set(const string& Str)
 {
-    if (Tag == NSB_NULL)
-        return "";
+    this->Str = Str;
+    Val = Value::MakeString(&this->Str);
+    Changed();
+}
 
-    if (Tag == NSB_INT)
-        return Relative ? string("@") + to_string(Val.Int) : to_string(Val.Int);
+void Variable::Set(const Value& Val)
+{
+    if (Val.IsNull())
+    {
+        this->Val = Value::MakeNull();
+        Str.clear();
+        Changed();
+    }
+    else if (const string* pStr = Val.GetString())
+    {
+        // Keep the id so constants stay cached
+        uint32_t Id = Val.Deref().Id;
+        this->Str = *pStr;
+        this->Val = Value::MakeString(&this->Str, Id);
+        Changed();
+    }
+    else if (Val.IsString())
+    {
+        string Temp;
+        Val.AppendTo(Temp);
+        Set(Temp);
+    }
+    else
+        Set(Val.ToInt());
+}
 
-    return Val.Str;
+int Variable::GetTag()
+{
+    return Val.GetTag();
+}
+
+float Variable::ToFloat()
+{
+    return Val.ToFloat();
+}
+
+int32_t Variable::ToInt()
+{
+    return Val.ToInt();
+}
+
+string Variable::ToString()
+{
+    return Val.ToString();
 }
 
 bool Variable::IsFloat()
 {
-    return Tag == NSB_FLOAT;
+    return Val.IsFloat();
 }
 
 bool Variable::IsInt()
 {
-    return Tag == NSB_INT || Tag == NSB_NULL || Relative || Nsb::ConstantToValue<Nsb::Boolean>(Val.Str) != -1;
+    return Val.IsInt();
 }
 
 bool Variable::IsString()
 {
-    return Tag == NSB_STRING || Tag == NSB_NULL || Relative;
+    return Val.IsString();
 }
 
 bool Variable::IsNull()
 {
-    return Tag == NSB_NULL;
+    return Val.IsNull();
+}
+
+Variable::Array* Variable::GetArray()
+{
+    if (!pArray)
+        pArray = new Array;
+    return pArray;
+}
+
+Variable* Variable::GetElement(int32_t Index)
+{
+    if (!pArray || Index < 0)
+        return nullptr;
+
+    if (Index < (int32_t)pArray->Elements.size())
+        return pArray->Elements[Index];
+
+    auto iter = pArray->Sparse.find(Index);
+    return iter != pArray->Sparse.end() ? iter->second : nullptr;
+}
+
+void Variable::SetElement(int32_t Index, Variable* pVar)
+{
+    if (Index < 0)
+        return;
+
+    Variable** ppSlot;
+    Array* pArray = GetArray();
+    if (Index < MAX_DENSE)
+    {
+        vector<Variable*>& Elements = pArray->Elements;
+        if (Index >= (int32_t)Elements.size())
+            Elements.resize(Index + 1, nullptr);
+        ppSlot = &Elements[Index];
+    }
+    else if (pVar)
+        ppSlot = &pArray->Sparse[Index];
+    else
+    {
+        auto iter = pArray->Sparse.find(Index);
+        if (iter == pArray->Sparse.end())
+            return;
+        pArray->Sparse.erase(iter);
+        pArray->Size--;
+        return;
+    }
+
+    if (!*ppSlot && pVar)
+        pArray->Size++;
+    else if (*ppSlot && !pVar)
+        pArray->Size--;
+    *ppSlot = pVar;
 }
 
-void Variable::Set(Variable* pVar)
+int32_t Variable::Count()
 {
-    Initialize(pVar);
+    return pArray ? pArray->Size : 0;
 }
 
-Variable* Variable::IntUnaryOp(function<int32_t(int32_t)> Func)
+bool Variable::GetKey(const string& Key, int32_t& Index)
 {
-    Val.Int = Func(Val.Int);
-    return this;
+    if (!pArray)
+        return false;
+
+    auto iter = pArray->Keys.find(Key);
+    if (iter == pArray->Keys.end())
+        return false;
+
+    Index = iter->second;
+    return true;
 }
 
-Variable* Variable::Add(Variable* pFirst, Variable* pSecond)
+void Variable::SetKey(const string& Key, int32_t Index)
 {
-    Variable* pThird = nullptr;
-    if (pFirst->IsInt())
-        pThird = MakeInt(pFirst->ToInt() + pSecond->ToInt());
-    else if (pFirst->IsString())
-        pThird = MakeString(pFirst->ToString() + pSecond->ToString());
+    GetArray()->Keys[Key] = Index;
+}
 
-    Destroy(pFirst);
-    Destroy(pSecond);
-    return pThird;
+void Variable::ClearKeys()
+{
+    if (pArray)
+        pArray->Keys.clear();
 }
 
-void Variable::Destroy(Variable* pVar)
+const map<string, int32_t>& Variable::GetKeys()
 {
-    if (pVar->Literal)
-        delete pVar;
+    static const map<string, int32_t> Empty;
+    return pArray ? pArray->Keys : Empty;
 }
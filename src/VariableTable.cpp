@@ -0,0 +1,97 @@
+/*
+ * libnpengine: Nitroplus script interpreter
+ * Copyright (C) 2018 Mislav Blažević <krofnica996@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * */
+#include "VariableTable.hpp"
+#include "CompiledScript.hpp"
+#include "Variable.hpp"
+#include <cctype>
+
+VariableTable::~VariableTable()
+{
+    for (Variable* pVar : Slots)
+        delete pVar;
+}
+
+Variable* VariableTable::Read(const string& Name)
+{
+    uint32_t Id;
+    if (!sStringTable.Find(Name, Id))
+        return nullptr;
+    return Read(Id);
+}
+
+Variable* VariableTable::Get(const string& Name)
+{
+    return Get(sStringTable.Intern(Name));
+}
+
+Variable* VariableTable::GetElement(Variable* pArray, int32_t Index)
+{
+    if (Variable* pVar = pArray->GetElement(Index))
+        return pVar;
+
+    // May have been created before its parent was, which did not link it
+    Variable* pVar = Get(pArray->Name + "/" + to_string(Index));
+    pArray->SetElement(Index, pVar);
+    return pVar;
+}
+
+Variable* VariableTable::Create(uint32_t Id)
+{
+    if (Id >= Slots.size())
+        Slots.resize(Id + 1, nullptr);
+
+    Variable* pVar = new Variable(sStringTable.Get(Id));
+    Slots[Id] = pVar;
+    Names[pVar->Name] = pVar;
+    Link(pVar);
+    return pVar;
+}
+
+// Index of an element named Array/Index, the digits after Slash
+static bool ElementIndex(const string& Name, size_t Slash, int32_t& Index)
+{
+    if (Slash + 1 == Name.size() || Name.size() - Slash > 10)
+        return false;
+
+    for (size_t i = Slash + 1; i < Name.size(); ++i)
+        if (!isdigit(Name[i]))
+            return false;
+
+    Index = stoi(Name.substr(Slash + 1));
+    return true;
+}
+
+// Variables may be created in any order, so link both to the parent and to existing elements
+void VariableTable::Link(Variable* pVar)
+{
+    const string& Name = pVar->Name;
+    size_t Slash = Name.rfind('/');
+    int32_t Index;
+    if (Slash != string::npos && ElementIndex(Name, Slash, Index))
+        if (Variable* pArray = Read(Name.substr(0, Slash)))
+            pArray->SetElement(Index, pVar);
+
+    string Prefix = Name + "/";
+    for (auto i = Names.lower_bound(Prefix); i != Names.end(); ++i)
+    {
+        if (i->first.compare(0, Prefix.size(), Prefix))
+            break;
+        if (ElementIndex(i->first, Name.size(), Index))
+            pVar->SetElement(Index, i->second);
+    }
+}
@@ -17,24 +17,61 @@
  * */
 #include <GL/glew.h>
 #include <iostream>
+#include <mutex>
+#include <map>
 #include "NSBInterpreter.hpp"
 #include "Window.hpp"
 #include "Texture.hpp"
+#include "EngineContext.hpp"
 
 uint32_t SDL_NSB_MOVECURSOR;
-Window* Object::pWindow = nullptr;
+static const uint32_t FRAME_TIME = 10;
 
-Window::Window(const char* WindowTitle, const int Width, const int Height) : WIDTH(Width), HEIGHT(Height), pInterpreter(nullptr), IsRunning(true), EventLoop(false)
+// Every engine polls the one SDL event queue, events are routed by window id
+static mutex WindowsLock;
+static map<uint32_t, Window*> Windows;
+
+static uint32_t GetWindowID(const SDL_Event& Event)
+{
+    switch (Event.type)
+    {
+        case SDL_WINDOWEVENT: return Event.window.windowID;
+        case SDL_KEYDOWN:
+        case SDL_KEYUP: return Event.key.windowID;
+        case SDL_TEXTEDITING: return Event.edit.windowID;
+        case SDL_TEXTINPUT: return Event.text.windowID;
+        case SDL_MOUSEMOTION: return Event.motion.windowID;
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP: return Event.button.windowID;
+        case SDL_MOUSEWHEEL: return Event.wheel.windowID;
+    }
+    if (Event.type == SDL_NSB_MOVECURSOR)
+        return Event.user.windowID;
+    return 0;
+}
+
+Window::Window(const char* WindowTitle, const int Width, const int Height) : WIDTH(Width), HEIGHT(Height), pInterpreter(nullptr), Budget(0), IsRunning(true), EventLoop(false), FirstFrame(true)
 {
-    Object::pWindow = this;
-    SDL_Init(SDL_INIT_VIDEO);
+    StartupTimeline& Timeline = sEngine->Timeline;
+    sEngine->pWindow = this;
+    // Reference counted by SDL, other engines may still use video
+    SDL_InitSubSystem(SDL_INIT_VIDEO);
+    Timeline.Mark("video");
     SDLWindow = SDL_CreateWindow(WindowTitle, 0, 0, WIDTH, HEIGHT, SDL_WINDOW_OPENGL);
+    WindowID = SDL_GetWindowID(SDLWindow);
+    {
+        lock_guard<mutex> Guard(WindowsLock);
+        Windows[WindowID] = this;
+    }
     GLContext = SDL_GL_CreateContext(SDLWindow);
-    SDL_NSB_MOVECURSOR = SDL_RegisterEvents(1);
+    Timeline.Mark("gl context");
+    static once_flag RegisterEvents;
+    call_once(RegisterEvents, [] { SDL_NSB_MOVECURSOR = SDL_RegisterEvents(1); });
 
     GLenum err = glewInit();
     if (err != GLEW_OK)
         cout << glewGetErrorString(err) << endl;
+    Timeline.Mark("glew");
 
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glViewport(0, 0, WIDTH, HEIGHT);
@@ -48,9 +85,13 @@ Window::Window(const char* WindowTitle, const int Width, const int Height) : WID
 
 Window::~Window()
 {
+    {
+        lock_guard<mutex> Guard(WindowsLock);
+        Windows.erase(WindowID);
+    }
     SDL_GL_DeleteContext(GLContext);
     SDL_DestroyWindow(SDLWindow);
-    SDL_Quit();
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
     delete pInterpreter;
 }
 
@@ -59,6 +100,7 @@ void Window::PushMoveCursorEvent(int X, int Y)
     SDL_Event Event;
     SDL_zero(Event);
     Event.type = SDL_NSB_MOVECURSOR;
+    Event.user.windowID = WindowID;
     Event.user.data1 = reinterpret_cast<void*>(X);
     Event.user.data2 = reinterpret_cast<void*>(Y);
     SDL_PushEvent(&Event);
@@ -71,14 +113,53 @@ void Window::Run()
     while (IsRunning)
     {
         while (SDL_PollEvent(&Event))
-            HandleEvent(Event);
+            Dispatch(Event);
+
+        vector<SDL_Event> Events;
+        {
+            lock_guard<mutex> Guard(InboxLock);
+            Events.swap(Inbox);
+        }
+        for (SDL_Event& Queued : Events)
+            HandleEvent(Queued);
 
         Draw();
-        pInterpreter->Run(100);
-        SDL_Delay(10);
+        if (!Budget)
+        {
+            pInterpreter->Run(100);
+            SDL_Delay(10);
+            continue;
+        }
+
+        // Sleep only for what is left of the frame
+        pInterpreter->RunFor(Budget);
+        uint32_t Spent = SDL_GetTicks() - LastDrawTime;
+        if (Spent < FRAME_TIME)
+            SDL_Delay(FRAME_TIME - Spent);
     }
 }
 
+// Events without a window, like SDL_QUIT, go to every window
+void Window::Dispatch(const SDL_Event& Event)
+{
+    uint32_t ID = GetWindowID(Event);
+    lock_guard<mutex> Guard(WindowsLock);
+    for (auto& i : Windows)
+    {
+        if (ID && i.first != ID)
+            continue;
+
+        lock_guard<mutex> InboxGuard(i.second->InboxLock);
+        i.second->Inbox.push_back(Event);
+    }
+}
+
+void Window::SetInterpreterBudget(uint32_t Budget, uint32_t Quota)
+{
+    this->Budget = Budget;
+    pInterpreter->SetQuota(Quota);
+}
+
 void Window::Exit()
 {
     IsRunning = false;
@@ -107,6 +188,11 @@ void Window::Draw()
     pInterpreter->Update(Diff);
     SDL_GL_SwapWindow(SDLWindow);
     LastDrawTime = CurrTime;
+    if (FirstFrame)
+    {
+        sEngine->Timeline.Mark("first frame");
+        FirstFrame = false;
+    }
 }
 
 void Window::DrawTextures(uint32_t Diff)
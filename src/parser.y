@@ -3,9 +3,8 @@
     #include <cstdio>
     #include <cstdlib>
 
-    extern TextParser::Text* pText;
     extern int yylex();
-    void yyerror(const char* s) { std::printf("Error: %s\n", s); std::abort(); }
+    void yyerror(TextParser::Text* pText, const char* s) { std::printf("Error: %s\n", s); std::abort(); }
 %}
 
 %union
@@ -20,6 +19,7 @@
 }
 
 %define api.prefix xml
+%parse-param { TextParser::Text* pText }
 
 %token <string> TSTRING THEX
 %token <token> TPRE TFONT TRUBY TVOICE TLBRACE TRBRACE TLABRACE TRABRACE TQUOTE TEQUAL TSLASH TNEWLINE